@@ -0,0 +1,263 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <stddef.h>
+
+/* Counts are kept per thread so that each benchmark thread is charged only
+ * for the allocations it makes itself. */
+static __thread int64_t harness_allocs_;
+static __thread int64_t sqlite_allocs_;
+static __thread int64_t sqlite_alloc_calls_;
+static __thread int64_t sqlite_alloc_nanos_;
+
+/* The allocator SQLite was configured with before we wrapped it */
+static sqlite3_mem_methods default_mem_;
+
+static void* counting_malloc(int n) {
+  uint64_t start = now_nanos();
+  void* p = default_mem_.xMalloc(n);
+  sqlite_alloc_nanos_ += now_nanos() - start;
+  sqlite_alloc_calls_++;
+  sqlite_allocs_++;
+  return p;
+}
+
+static void counting_free(void* p) {
+  uint64_t start = now_nanos();
+  default_mem_.xFree(p);
+  sqlite_alloc_nanos_ += now_nanos() - start;
+  sqlite_alloc_calls_++;
+}
+
+static void* counting_realloc(void* p, int n) {
+  uint64_t start = now_nanos();
+  void* q = default_mem_.xRealloc(p, n);
+  sqlite_alloc_nanos_ += now_nanos() - start;
+  sqlite_alloc_calls_++;
+  sqlite_allocs_++;
+  return q;
+}
+
+/*
+ * Route SQLite's allocations through counting wrappers, which also time
+ * each call.  Must be called before SQLite is initialized, i.e. before the
+ * first connection is opened, and after sqlite_malloc_init().
+ */
+void alloc_stats_init() {
+  sqlite3_mem_methods mem;
+
+  sqlite3_config(SQLITE_CONFIG_GETMALLOC, &default_mem_);
+  mem = default_mem_;
+  mem.xMalloc = counting_malloc;
+  mem.xFree = counting_free;
+  mem.xRealloc = counting_realloc;
+  if (sqlite3_config(SQLITE_CONFIG_MALLOC, &mem) != SQLITE_OK) {
+    fprintf(stderr, "failed to install counting allocator\n");
+    exit(1);
+  }
+}
+
+int64_t alloc_count_harness() {
+  return harness_allocs_;
+}
+
+int64_t alloc_count_sqlite() {
+  return sqlite_allocs_;
+}
+
+/*
+ * Nanoseconds this thread has spent in SQLite's allocator, less the cost
+ * of reading the clock around each call.
+ */
+int64_t alloc_nanos_sqlite() {
+  return sqlite_alloc_nanos_ -
+         (int64_t)(sqlite_alloc_calls_ * clock_overhead_nanos());
+}
+
+/* Start SQLite's memory high-water mark over, for a new benchmark */
+void alloc_reset_peak() {
+  sqlite3_int64 used, high;
+  sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &high, 1);
+}
+
+/* Zero the lookaside counters of db */
+void lookaside_reset(sqlite3* db) {
+  int cur, high;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &cur, &high, 1);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &cur, &high, 1);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &cur, &high, 1);
+}
+
+/*
+ * Allocations db served from lookaside since the last reset, and those it
+ * could not because the request was too big or every slot was in use.
+ */
+void lookaside_counts(sqlite3* db, int64_t* hits, int64_t* misses) {
+  int cur, hit, miss_size, miss_full;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &cur, &hit, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &cur,
+                    &miss_size, 0);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &cur,
+                    &miss_full, 0);
+  *hits = hit;
+  *misses = miss_size + miss_full;
+}
+
+/* Allocation helpers for harness code that runs while a benchmark is timed */
+void* bench_malloc(size_t size) {
+  harness_allocs_++;
+  return malloc(size);
+}
+
+void* bench_calloc(size_t nmemb, size_t size) {
+  harness_allocs_++;
+  return calloc(nmemb, size);
+}
+
+void* bench_realloc(void* p, size_t size) {
+  harness_allocs_++;
+  return realloc(p, size);
+}
+
+/*
+ * --sqlite_malloc=pool: segregated free lists over one preallocated heap of
+ * --heap_size bytes.  Each block carries an 8-byte header with its size
+ * class; requests too big for any class, or made once the heap is used up,
+ * go to malloc() and are counted as fallbacks.  Freed blocks return to
+ * their class's list, so the heap only ever serves the classes that were
+ * asked for first.
+ */
+
+#define kPoolClasses 24
+#define kPoolLarge 0xffffffffu
+
+/* 16, 24, 32, 48, 64, 96, ... 32768, 49152 */
+static int pool_class_size_[kPoolClasses];
+
+typedef struct PoolBlock {
+  uint32_t class_;             /* kPoolLarge for malloc()ed blocks */
+  uint32_t size_;              /* usable bytes */
+} PoolBlock;
+
+static pthread_mutex_t pool_mu_ = PTHREAD_MUTEX_INITIALIZER;
+static void* pool_free_[kPoolClasses];
+static char* pool_heap_;
+static char* pool_next_;
+static char* pool_end_;
+static __thread int64_t pool_fallbacks_;
+
+static int pool_class(int n) {
+  for (int c = 0; c < kPoolClasses; c++) {
+    if (n <= pool_class_size_[c]) return c;
+  }
+  return -1;
+}
+
+static void* pool_malloc(int n) {
+  int c = pool_class(n);
+  PoolBlock* b = NULL;
+  if (c >= 0) {
+    pthread_mutex_lock(&pool_mu_);
+    if (pool_free_[c] != NULL) {
+      b = pool_free_[c];
+      pool_free_[c] = *(void**)&b[1];
+    } else if (pool_end_ - pool_next_ >=
+               (ptrdiff_t)(sizeof(PoolBlock) + pool_class_size_[c])) {
+      b = (PoolBlock*)pool_next_;
+      pool_next_ += sizeof(PoolBlock) + pool_class_size_[c];
+      b->class_ = c;
+      b->size_ = pool_class_size_[c];
+    }
+    pthread_mutex_unlock(&pool_mu_);
+  }
+  if (b == NULL) {
+    b = malloc(sizeof(PoolBlock) + n);
+    if (b == NULL) return NULL;
+    b->class_ = kPoolLarge;
+    b->size_ = n;
+    pool_fallbacks_++;
+  }
+  return &b[1];
+}
+
+static void pool_free(void* p) {
+  PoolBlock* b = (PoolBlock*)p - 1;
+  if (b->class_ == kPoolLarge) {
+    free(b);
+    return;
+  }
+  pthread_mutex_lock(&pool_mu_);
+  *(void**)p = pool_free_[b->class_];
+  pool_free_[b->class_] = b;
+  pthread_mutex_unlock(&pool_mu_);
+}
+
+static int pool_size(void* p) {
+  return ((PoolBlock*)p - 1)->size_;
+}
+
+static void* pool_realloc(void* p, int n) {
+  if (n <= pool_size(p)) return p;
+  void* q = pool_malloc(n);
+  if (q == NULL) return NULL;
+  memcpy(q, p, pool_size(p));
+  pool_free(p);
+  return q;
+}
+
+static int pool_roundup(int n) {
+  int c = pool_class(n);
+  return c >= 0 ? pool_class_size_[c] : (n + 7) & ~7;
+}
+
+static int pool_init(void* arg) {
+  return SQLITE_OK;
+}
+
+static void pool_shutdown(void* arg) {
+}
+
+/* Allocations by this thread that the pool passed to malloc() */
+int64_t pool_fallback_count() {
+  return pool_fallbacks_;
+}
+
+/*
+ * Install the --sqlite_malloc allocator.  Like alloc_stats_init() this
+ * must run before SQLite is initialized.
+ */
+void sqlite_malloc_init(const char* name, int64_t heap_size) {
+  if (!strcmp(name, "system")) return;
+  pool_heap_ = malloc(heap_size);
+  if (pool_heap_ == NULL) {
+    fprintf(stderr, "cannot allocate a %" PRId64 " byte heap\n", heap_size);
+    exit(1);
+  }
+  if (!strcmp(name, "memsys5")) {
+    if (!sqlite3_compileoption_used("ENABLE_MEMSYS5") ||
+        sqlite3_config(SQLITE_CONFIG_HEAP, pool_heap_, (int)heap_size,
+                       32) != SQLITE_OK) {
+      fprintf(stderr, "memsys5 is not available "
+              "(build SQLite with -DSQLITE_ENABLE_MEMSYS5)\n");
+      exit(1);
+    }
+    return;
+  }
+
+  for (int c = 0; c < kPoolClasses; c++) {
+    pool_class_size_[c] = (c % 2 == 0 ? 16 : 24) << (c / 2);
+  }
+  pool_next_ = pool_heap_;
+  pool_end_ = pool_heap_ + heap_size;
+  static const sqlite3_mem_methods methods = {
+    pool_malloc, pool_free, pool_realloc, pool_size, pool_roundup,
+    pool_init, pool_shutdown, NULL
+  };
+  if (sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) != SQLITE_OK) {
+    fprintf(stderr, "failed to install the pool allocator\n");
+    exit(1);
+  }
+}
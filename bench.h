@@ -8,7 +8,9 @@
 #include <assert.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -18,27 +20,79 @@
 #include <time.h>
 #include "sqlite3.h"
 
-#define kNumBuckets 154
 #define kNumData 1000000
+#define kKeySize 16
 
+/* Largest value a histogram resolves: one hour in nanoseconds */
+#define kHistogramMaxValue 3600000000000LL
+
+/*
+ * Log-linear (HDR) histogram.  Values are grouped in power-of-two buckets,
+ * each split linearly into sub-buckets so that every recorded value keeps
+ * FLAGS_histogram_digits significant decimal digits.
+ */
 typedef struct Histogram {
   double min_;
   double max_;
   double num_;
   double sum_;
   double sum_squares_;
-  double buckets_[kNumBuckets];
+
+  int digits_;
+  int sub_bucket_half_count_magnitude_;
+  int sub_bucket_half_count_;
+  int64_t sub_bucket_mask_;
+  int counts_len_;
+  int64_t *counts_;  /* allocated on first use */
 } Histogram;
 
+typedef struct Random {
+  uint32_t seed_;
+} Random;
+
 typedef struct Raw {
   double *data_;
   size_t data_size_;
   int pos_;
+
+  /* With --raw_sample, data_ is a reservoir of the seen_ samples below
+   * --raw_threshold and tail_ keeps all samples above it. */
+  int64_t seen_;
+  Random rand_;
+  double *tail_;
+  size_t tail_size_;
+  int tail_pos_;
 } Raw;
 
-typedef struct Random {
-  uint32_t seed_;
-} Random;
+/* Per-thread buffer of the streaming raw log (--raw_file) */
+typedef struct RawLog {
+  char *buf_;
+  size_t pos_;
+} RawLog;
+
+enum KeyDist {
+  UNIFORM,
+  ZIPFIAN,
+  SCRAMBLED_ZIPFIAN,
+  HOTSPOT,
+  LATEST
+};
+
+typedef struct KeyGenerator {
+  int dist_;
+  int items_;
+
+  /* Zipfian */
+  double theta_;
+  double zetan_;
+  double alpha_;
+  double eta_;
+
+  /* Hotspot */
+  double hot_ops_fraction_;
+  double hot_keys_fraction_;
+  int hot_items_;
+} KeyGenerator;
 
 typedef struct RandomGenerator {
   char *data_;
@@ -46,6 +100,180 @@ typedef struct RandomGenerator {
   int pos_;
 } RandomGenerator;
 
+/* Operation types for per-type latency of mixed workloads */
+enum OpType {
+  OP_READ,
+  OP_WRITE,
+  OP_UPDATE,
+  OP_INSERT,
+  OP_SCAN,
+  OP_READ_MODIFY_WRITE,
+  OP_DELETE
+};
+#define kNumOpTypes 7
+
+/* Distribution of value sizes or scan lengths in a workload phase */
+enum SizeDistKind {
+  SIZE_FIXED,
+  SIZE_UNIFORM,
+  SIZE_NORMAL
+};
+
+typedef struct SizeDist {
+  int kind_;
+  double a_;                 /* fixed size, minimum or mean */
+  double b_;                 /* maximum or standard deviation */
+} SizeDist;
+
+/* One phase of a --workload file */
+typedef struct WorkloadPhase {
+  char name_[64];
+  double mix_[kNumOpTypes];  /* cumulative probability by OpType */
+  bool sequential_;
+  int key_dist_;
+  int key_space_;            /* 0: --num plus keys inserted so far */
+  double zipf_theta_;
+  double hot_ops_fraction_;
+  double hot_keys_fraction_;
+  SizeDist value_size_;
+  SizeDist scan_length_;
+  int64_t ops_;              /* per thread; 0: until seconds_ */
+  double seconds_;           /* 0: until ops_ */
+  int threads_;
+  int batch_;
+  bool sync_;
+  bool fresh_;
+} WorkloadPhase;
+
+typedef struct Workload {
+  WorkloadPhase* phases_;
+  int num_phases_;
+} Workload;
+
+/* A value bound to a statement in a --replay trace */
+typedef struct TraceParam {
+  char type_;                /* N, I, F, T, B or Z as in the trace file */
+  int64_t int_;              /* I, or the length of a Z zeroblob */
+  double real_;
+  char* data_;               /* T or B */
+  int len_;
+} TraceParam;
+
+/* One statement execution in a --replay trace */
+typedef struct TraceRecord {
+  int64_t nanos_;            /* when it started, as recorded */
+  int sql_;                  /* index into Trace.sql_ */
+  int num_params_;
+  TraceParam* params_;
+} TraceRecord;
+
+/* The statements one connection ran, in order */
+typedef struct TraceStream {
+  int conn_;
+  TraceRecord* records_;
+  int num_records_;
+  int capacity_;
+} TraceStream;
+
+typedef struct Trace {
+  TraceStream* streams_;
+  int num_streams_;
+  int64_t num_records_;
+  int64_t start_nanos_;      /* earliest record */
+  char** sql_;               /* distinct statement texts */
+  int* fingerprint_of_;      /* by sql_ index */
+  int num_sql_;
+  char** fingerprints_;
+  int num_fingerprints_;
+} Trace;
+
+/* The start of every open file of a VFS shim (vfs_shim.c) */
+typedef struct ShimFile {
+  sqlite3_file base_;
+  sqlite3_file* real_;       /* follows the shim's file struct */
+} ShimFile;
+
+#define SHIM_REAL(f) (((ShimFile*)(f))->real_)
+
+/* A VFS wrapping another, forwarding whatever it does not override */
+typedef struct VfsShim {
+  sqlite3_vfs vfs_;
+  sqlite3_vfs* real_;
+  size_t file_size_;         /* of the shim's file struct */
+  sqlite3_io_methods methods_;
+  sqlite3_io_methods methods_v1_;
+  /* If set, called once the real file is open with the result of that */
+  int (*open_)(sqlite3_file*, const char*, int, int);
+} VfsShim;
+
+/* Timestamps are in nanoseconds from now_nanos() */
+typedef struct Stats {
+  uint64_t start_;
+  uint64_t finish_;
+  double seconds_;
+  uint64_t last_op_finish_;
+  int done_;
+  int next_report_;
+  int threads_;
+  int64_t bytes_;
+  int64_t rows_;
+  const char* op_unit_;
+
+  /* Allocations made by this thread while the benchmark ran */
+  int64_t harness_allocs_;
+  int64_t sqlite_allocs_;
+  int64_t sqlite_alloc_nanos_;
+  int64_t lookaside_hits_;
+  int64_t lookaside_misses_;
+  int64_t pool_fallbacks_;
+
+  /* SQLite mutexes entered by this thread, and the time it took */
+  int64_t mutex_enters_;
+  int64_t mutex_nanos_;
+
+  /* Page faults taken by this thread while the benchmark ran */
+  int64_t minor_faults_;
+  int64_t major_faults_;
+
+  /* Page cache hits, misses and evictions by this thread (--pcache) */
+  int64_t pcache_hits_;
+  int64_t pcache_misses_;
+  int64_t pcache_evictions_;
+  Histogram hist_;
+  Raw raw_;
+
+  /* Open-loop arrivals (--target_rate) */
+  double next_arrival_;
+  uint64_t op_scheduled_;
+  uint64_t op_start_;
+  Histogram service_hist_;
+
+  /* Per operation type */
+  int64_t op_done_[kNumOpTypes];
+  Histogram op_hist_[kNumOpTypes];
+
+  /* Current --stats_interval sample */
+  uint64_t interval_start_;
+  int interval_done_;
+  int64_t interval_bytes_;
+  Histogram interval_hist_;
+} Stats;
+
+/* Per-thread state for concurrent executions of the same benchmark. */
+typedef struct ThreadState {
+  int tid_;
+  sqlite3* db_;
+  Random rand_;
+  RandomGenerator gen_;
+  Stats stats_;
+  bool measure_latency_;
+  Random arrival_rand_;
+  double arrival_interval_;  /* nanoseconds */
+  int key_;                  /* key of the current op, -1 if none */
+  RawLog raw_log_;
+  struct SharedState* shared_;
+} ThreadState;
+
 // Comma-separated list of operations to run in the specified order
 //   Actual benchmarks:
 //
@@ -59,10 +287,35 @@ typedef struct RandomGenerator {
 //   fillrand100K  -- write N/1000 100K values in random order in async mode
 //   fillseq100K   -- write N/1000 100K values in sequential order in async mode
 //   readseq       -- read N times sequentially
+//   readreverse   -- read N times in reverse order
 //   readrandom    -- read N times in random order
+//   seekrandom    -- seek N times to random keys
+//   scanrandom    -- seek N times to random keys and read scan_length rows
 //   readrand100K  -- read N/1000 100K values in sequential order in async mode
+//   readwhilewriting -- read N times in random order while a writer overwrites
+//   ycsb_a        -- YCSB A: 50% read, 50% update, zipfian
+//   ycsb_b        -- YCSB B: 95% read, 5% update, zipfian
+//   ycsb_c        -- YCSB C: 100% read, zipfian
+//   ycsb_d        -- YCSB D: 95% read, 5% insert, latest
+//   ycsb_e        -- YCSB E: 95% short scan, 5% insert, zipfian
+//   ycsb_f        -- YCSB F: 50% read, 50% read-modify-write, zipfian
 extern char* FLAGS_benchmarks;
 
+// If set, run the phases of this workload file instead of --benchmarks
+extern char* FLAGS_workload;
+
+// If set, replay the statements of this trace file instead of --benchmarks
+extern char* FLAGS_replay;
+
+// Database to replay against; if NULL, a new benchmark database
+extern char* FLAGS_replay_db;
+
+// Multiple of the recorded pace to replay at; 0 for as fast as possible
+extern double FLAGS_replay_speed;
+
+// If set, record every statement run to this file in the --replay format
+extern char* FLAGS_trace_out;
+
 // Number of key/values to place in database
 extern int FLAGS_num;
 
@@ -103,24 +356,196 @@ extern bool FLAGS_WAL_enabled;
 // Use the db with the following name.
 extern char* FLAGS_db;
 
+// Issue operations open-loop at this many ops per second in total.  Each
+// thread keeps its own schedule at its share of the rate, and latency is
+// measured from each op's scheduled start time.
+// If zero, each op is issued as soon as the previous one finishes.
+extern double FLAGS_target_rate;
+
+// Arrival process for --target_rate: "constant" or "poisson"
+extern char* FLAGS_arrival;
+
+// Distribution of keys for random reads and writes: uniform, zipfian,
+// scrambled_zipfian, hotspot or latest
+extern char* FLAGS_key_dist;
+
+// Skew of the zipfian, scrambled_zipfian and latest distributions
+extern double FLAGS_zipf_theta;
+
+// For the hotspot distribution, this fraction of operations goes to
+// the first FLAGS_hotspot_keys_fraction of the key space
+extern double FLAGS_hotspot_ops_fraction;
+extern double FLAGS_hotspot_keys_fraction;
+
+// Number of rows read after each seek by scanrandom
+extern int FLAGS_scan_length;
+
+// Number of concurrent threads to run.  Each thread uses its own
+// connection.  Read benchmarks are repeated for 1..N threads to
+// report scaling.
+extern int FLAGS_threads;
+
+// If positive, emit ops/s, MB/s and latency percentiles of each
+// benchmark thread every FLAGS_stats_interval seconds
+extern double FLAGS_stats_interval;
+
+// Format of the --stats_interval samples: "csv" or "json"
+extern char* FLAGS_stats_format;
+
+// File the --stats_interval samples are written to; stdout if NULL
+extern char* FLAGS_stats_file;
+
+// If positive, keep a uniform sample of this many latencies per
+// benchmark for --raw instead of all of them
+extern int FLAGS_raw_sample;
+
+// With --raw_sample, always keep latencies of at least this many ns
+extern double FLAGS_raw_threshold;
+
+// If set, stream every op's latency to this file in binary form
+extern char* FLAGS_raw_file;
+
+// If set, write the --raw_file log at this path as CSV to stdout and exit
+extern char* FLAGS_decode_raw;
+
+// If true, count I/O calls, bytes and latency through a VFS shim and
+// report them per benchmark
+extern bool FLAGS_vfs_stats;
+
+// If set, write a report of the run; "json:PATH" writes JSON to PATH
+extern char* FLAGS_report;
+
+// Where databases are kept: "disk" (files under FLAGS_db) or "memory"
+// (shared between the connections of the process)
+extern char* FLAGS_storage;
+
+// If true, issue database I/O through io_uring, batching writes
+extern bool FLAGS_io_uring;
+
+// With --io_uring, write from buffers registered with the ring
+extern bool FLAGS_io_uring_registered;
+
+// If true, open database and WAL files with O_DIRECT, bypassing the
+// page cache
+extern bool FLAGS_direct_io;
+
+// If not negative, PRAGMA mmap_size of every connection
+extern int64_t FLAGS_mmap_size;
+
+// madvise() advice for the database mapping with --mmap_size: "none"
+// (leave it alone), "normal", "random", "sequential" or "willneed"
+extern char* FLAGS_madvise;
+
+// If true, report page faults per op; implied by --mmap_size
+extern bool FLAGS_fault_stats;
+
+// Page cache: "default" (SQLite's own), "arena", "clock" or "hugepage"
+extern char* FLAGS_pcache;
+
+// Latency injected into xRead, xWrite and xSync calls by a VFS shim:
+// "fixed:MICROS", "uniform:MIN,MAX" or "file:PATH"; none if NULL
+extern char* FLAGS_read_delay;
+extern char* FLAGS_write_delay;
+extern char* FLAGS_sync_delay;
+
+// If positive, limit reads and writes together to this many MB/s
+extern double FLAGS_io_throughput;
+
+// Significant decimal digits kept by latency histograms (1-4)
+extern int FLAGS_histogram_digits;
+
+// If set, append each benchmark's latency histogram to this file
+extern char* FLAGS_histogram_out;
+
+// If set, merge the comma-separated histogram files written with
+// --histogram_out, report them and exit
+extern char* FLAGS_histogram_merge;
+
+// Clock used for timing: "monotonic" or "tsc"
+extern char* FLAGS_clock;
+
+// If true, count the allocations made by the harness and by SQLite and
+// report them per op.
+extern bool FLAGS_alloc_stats;
+
+// SQLite's allocator: "system" (malloc), "memsys5" or "pool"
+extern char* FLAGS_sqlite_malloc;
+
+// Bytes preallocated for the memsys5 and pool allocators
+extern int64_t FLAGS_heap_size;
+
+// If not negative, bytes per lookaside slot of each connection
+extern int FLAGS_lookaside_size;
+
+// If not negative, lookaside slots of each connection (0 disables it)
+extern int FLAGS_lookaside_count;
+
+// SQLite threading mode: "single", "multi" or "serialized"
+extern char* FLAGS_threading;
+
+// Per-connection mutexing: "default" (the threading mode's), "nomutex"
+// (SQLITE_OPEN_NOMUTEX) or "fullmutex" (SQLITE_OPEN_FULLMUTEX)
+extern char* FLAGS_open_mutex;
+
+// If true, time SQLite's mutex calls and report them per op
+extern bool FLAGS_mutex_stats;
+
+/* alloc.c */
+void alloc_stats_init(void);
+int64_t alloc_count_harness(void);
+int64_t alloc_count_sqlite(void);
+int64_t alloc_nanos_sqlite(void);
+void alloc_reset_peak(void);
+void lookaside_reset(sqlite3*);
+void lookaside_counts(sqlite3*, int64_t*, int64_t*);
+void* bench_malloc(size_t);
+void* bench_calloc(size_t, size_t);
+void* bench_realloc(void*, size_t);
+int64_t pool_fallback_count(void);
+void sqlite_malloc_init(const char*, int64_t);
+
+/* mutex.c */
+void threading_init(const char*);
+int open_mutex_flags(const char*);
+void mutex_stats_init(void);
+int64_t mutex_count_enters(void);
+int64_t mutex_nanos(void);
+
+/* pcache.c */
+void pcache_init(const char*);
+const char* pcache_hugepage_source(void);
+void pcache_counts(int64_t*, int64_t*, int64_t*);
+int64_t pcache_footprint(int64_t*);
+void pcache_reset_peak(void);
+
 /* benchmark.c */
 void benchmark_init(void);
 void benchmark_fini(void);
 void benchmark_run(void);
 void benchmark_open(void);
-void benchmark_write(bool, int, int, int, int, int);
-void benchmark_read(int, int);
-void benchmark_read_sequential(void);
+void benchmark_write(ThreadState*, bool, int, int, int, int, int);
+void benchmark_read(ThreadState*, int, int);
+void benchmark_read_sequential(ThreadState*, bool);
+void benchmark_seek(ThreadState*, int);
+void benchmark_merge_histograms(const char*);
+bool benchmark_decode_raw(const char*);
 
 /* histogram.c */
 void histogram_clear(Histogram*);
 void histogram_add(Histogram*, double);
 void histogram_merge(Histogram*, const Histogram*);
+void histogram_free(Histogram*);
+double histogram_percentile(Histogram*, double);
 char* histogram_to_string(Histogram*);
+int64_t histogram_bucket_value(Histogram*, int);
+void histogram_write(FILE*, const char*, Histogram*);
+bool histogram_read(FILE*, char*, size_t, Histogram*);
 
 /* Raw */
-void raw_clear(Raw *);
+void raw_clear(Raw *, uint32_t);
 void raw_add(Raw *, double);
+void raw_merge(Raw *, const Raw *);
+void raw_free(Raw *);
 char* raw_to_string(Raw *);
 void raw_print(FILE *, Raw *);
 
@@ -128,12 +553,92 @@ void raw_print(FILE *, Raw *);
 void rand_init(Random*, uint32_t);
 uint32_t rand_next(Random*);
 uint32_t rand_uniform(Random*, int);
+double rand_double(Random*);
+int key_dist_from_string(const char*);
+const char* key_dist_to_string(int);
+void key_gen_init(KeyGenerator*, int, int, double, double, double);
+int key_gen_next(KeyGenerator*, Random*);
+void key_gen_resize(KeyGenerator*, int);
 void rand_gen_init(RandomGenerator*, double);
-char* rand_gen_generate(RandomGenerator*, int);
+const char* rand_gen_generate(RandomGenerator*, int);
+
+/* rawlog.c */
+bool raw_log_enabled(void);
+void raw_log_open(const char*);
+void raw_log_close(void);
+void raw_log_benchmark(const char*);
+void raw_log_add(RawLog*, int, int, int, uint64_t, uint64_t);
+void raw_log_flush(RawLog*);
+void raw_log_free(RawLog*);
+bool raw_log_decode(const char*, FILE*, const char**);
+
+/* report.c */
+bool report_enabled(void);
+void report_begin(const char*);
+void report_end(void);
+void report_begin_object(const char*);
+void report_end_object(void);
+void report_begin_array(const char*);
+void report_end_array(void);
+void report_string(const char*, const char*);
+void report_int(const char*, int64_t);
+void report_double(const char*, double);
+void report_bool(const char*, bool);
+void report_histogram(const char*, Histogram*);
+
+/* vfs_delay.c */
+bool vfs_delay_enabled(void);
+void vfs_delay_init(void);
+void vfs_delay_fini(void);
+
+/* vfs_direct.c */
+bool vfs_direct_init(void);
+
+/* vfs_io_uring.c */
+bool vfs_io_uring_init(bool);
+void vfs_io_uring_fini(void);
+
+/* vfs_madvise.c */
+int madvise_from_string(const char*);
+void vfs_madvise_init(const char*);
+
+/* vfs_memory.c */
+void vfs_memory_init(void);
+void vfs_memory_clear(void);
+
+/* vfs_shim.c */
+void vfs_shim_init(VfsShim*, const char*, size_t);
+void vfs_shim_register(VfsShim*);
+
+/* vfs_stats.c */
+void vfs_stats_init(void);
+void vfs_stats_reset(void);
+void vfs_stats_print(FILE*, int64_t);
+void vfs_stats_report(int64_t);
+
+/* workload.c */
+void workload_load(Workload*, const char*);
+void workload_free(Workload*);
+int workload_next_op(const WorkloadPhase*, Random*);
+bool workload_writes(const WorkloadPhase*);
+int workload_value_size(const WorkloadPhase*, Random*);
+int workload_scan_length(const WorkloadPhase*, Random*);
+
+/* trace.c */
+int trace_capture(sqlite3*, FILE*);
+void trace_pause(bool);
+void trace_load(Trace*, const char*);
+void trace_free(Trace*);
 
 /* util.c */
-uint64_t now_micros(void);
+bool clock_init(const char*);
+uint64_t now_nanos(void);
+double clock_overhead_nanos(void);
+void sleep_micros(uint64_t);
+void thread_faults(int64_t*, int64_t*);
+void encode_key(char*, int);
 bool starts_with(const char*, const char*);
 char* trim_space(const char*);
+int unix_file_fd(sqlite3_file*, const char*);
 
 #endif /* BENCH_H_ */
@@ -14,28 +14,96 @@ enum DBState {
   EXISTING
 };
 
+/* State shared by the threads of a concurrent benchmark */
+typedef struct SharedState {
+  pthread_mutex_t mu_;
+  pthread_cond_t cv_;
+  int total_;
+
+  /* Each thread goes through the following states:
+   *    (1) initializing
+   *    (2) waiting for others to be initialized
+   *    (3) running
+   *    (4) done
+   */
+  int num_initialized_;
+  int num_done_;
+  bool start_;
+} SharedState;
+
+typedef struct ThreadArg {
+  SharedState* shared_;
+  ThreadState* thread_;
+  void (*method_)(ThreadState*);
+} ThreadArg;
+
+/* YCSB core workload: operation mix and request distribution */
+typedef struct YcsbWorkload {
+  const char* name_;
+  double read_;
+  double update_;
+  double insert_;
+  double scan_;
+  double read_modify_write_;
+  int key_dist_;
+} YcsbWorkload;
+
+static const YcsbWorkload ycsb_workloads[] = {
+  /* name     read  update insert scan  rmw */
+  { "ycsb_a", 0.50, 0.50,  0,     0,    0,    SCRAMBLED_ZIPFIAN },
+  { "ycsb_b", 0.95, 0.05,  0,     0,    0,    SCRAMBLED_ZIPFIAN },
+  { "ycsb_c", 1.00, 0,     0,     0,    0,    SCRAMBLED_ZIPFIAN },
+  { "ycsb_d", 0.95, 0,     0.05,  0,    0,    LATEST },
+  { "ycsb_e", 0,    0,     0.05,  0.95, 0,    SCRAMBLED_ZIPFIAN },
+  { "ycsb_f", 0.50, 0,     0,     0,    0.50, SCRAMBLED_ZIPFIAN },
+  { NULL, 0, 0, 0, 0, 0, 0 }
+};
+
+/* Maximum length of a YCSB scan; lengths are uniform in [1, max] */
+#define kYcsbMaxScanLength 100
+
+static const char* op_type_names[kNumOpTypes] = {
+  "read", "write", "update", "insert", "scan", "readmodifywrite", "delete"
+};
+
 sqlite3* db_;
 int db_num_;
 int num_;
 int reads_;
-double start_;
-double last_op_finish_;
-int64_t bytes_;
 char* message_;
-Histogram hist_;
-Raw raw_;
+bool poisson_arrival_;
+int key_dist_;
+const YcsbWorkload* ycsb_;
+int ycsb_records_;
+Workload workload_;
+const WorkloadPhase* phase_;
+int phase_keys_;
+int phase_next_key_;
+int workload_records_;
+Trace trace_;
+Histogram* replay_hists_;     /* [thread][fingerprint] */
+int64_t* replay_errors_;      /* [thread][fingerprint] */
+uint64_t* replay_lag_;        /* [thread] */
+bool* replay_closed_;         /* [thread], under the threads' mutex */
+uint64_t replay_start_;
+Histogram* replay_merged_;    /* [fingerprint], while it is reported */
+int64_t* replay_merged_errors_;
+FILE* trace_out_;
 RandomGenerator gen_;
-Random rand_;
-
-/* State kept for progress messages */
-int done_;
-int next_report_;
+ThreadState thread_;
+const char* benchmark_name_;
+FILE* stats_file_;
+pthread_mutex_t stats_file_mu_ = PTHREAD_MUTEX_INITIALIZER;
 
 static void print_header(void);
 static void print_warnings(void);
 static void print_environment(void);
-static void start(void);
-static void stop(const char *name);
+static void start(ThreadState*);
+static void read_while_writing(ThreadState*);
+static void run_ycsb(ThreadState*);
+static void run_phase(ThreadState*);
+static void replay_connection(ThreadState*);
+static void stop(ThreadState*, const char *name);
 
 inline
 static void exec_error_check(int status, char *err_msg) {
@@ -62,6 +130,38 @@ static void error_check(int status) {
   }
 }
 
+/*
+ * Run a BEGIN or END TRANSACTION, trying again for as long as another
+ * connection holds the lock.  Each try waits out the busy timeout, but
+ * several threads taking the write lock for a batch at a time can keep
+ * one waiting for longer.
+ */
+static void step_transaction(sqlite3_stmt* stmt) {
+  int status;
+  while ((status = sqlite3_step(stmt)) == SQLITE_BUSY) {
+    sqlite3_reset(stmt);
+  }
+  step_error_check(status);
+  status = sqlite3_reset(stmt);
+  error_check(status);
+}
+
+/*
+ * Step stmt until it stops returning rows.  Outside an explicit transaction
+ * a statement that got SQLITE_BUSY has taken no lock and changed nothing,
+ * so it runs again: with a rollback journal, readers and the writer of
+ * readwhilewriting can keep each other waiting past the busy timeout.
+ */
+static int step_rows(sqlite3_stmt* stmt) {
+  int status;
+  do {
+    while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {}
+    if (status == SQLITE_BUSY) sqlite3_reset(stmt);
+  } while (status == SQLITE_BUSY &&
+           sqlite3_get_autocommit(sqlite3_db_handle(stmt)));
+  return status;
+}
+
 inline
 static void wal_checkpoint(sqlite3* db_) {
   /* Flush all writes to disk */
@@ -72,11 +172,73 @@ static void wal_checkpoint(sqlite3* db_) {
 }
 
 static void print_header() {
-  const int kKeySize = 16;
   print_environment();
   fprintf(stderr, "Keys:       %d bytes each\n", kKeySize);
   fprintf(stderr, "Values:     %d bytes each\n", FLAGS_value_size);  
   fprintf(stderr, "Entries:    %d\n", num_);
+  if (key_dist_ == ZIPFIAN || key_dist_ == SCRAMBLED_ZIPFIAN ||
+      key_dist_ == LATEST) {
+    fprintf(stderr, "KeyDist:    %s (theta %.2f)\n",
+            FLAGS_key_dist, FLAGS_zipf_theta);
+  } else if (key_dist_ == HOTSPOT) {
+    fprintf(stderr, "KeyDist:    %s (%.0f%% of ops to %.0f%% of keys)\n",
+            FLAGS_key_dist, FLAGS_hotspot_ops_fraction * 100,
+            FLAGS_hotspot_keys_fraction * 100);
+  } else {
+    fprintf(stderr, "KeyDist:    %s\n", FLAGS_key_dist);
+  }
+  if (FLAGS_workload != NULL) {
+    fprintf(stderr, "Workload:   %s (%d phases)\n", FLAGS_workload,
+            workload_.num_phases_);
+  }
+  if (FLAGS_replay != NULL) {
+    fprintf(stderr, "Replay:     %s (%" PRId64 " statements on %d "
+            "connections, %d fingerprints)\n", FLAGS_replay,
+            trace_.num_records_, trace_.num_streams_,
+            trace_.num_fingerprints_);
+    if (FLAGS_replay_speed > 0) {
+      fprintf(stderr, "Pace:       %gx recorded\n", FLAGS_replay_speed);
+    } else {
+      fprintf(stderr, "Pace:       as fast as possible\n");
+    }
+  }
+  fprintf(stderr, "Clock:      %s (%.1f ns per read)\n",
+          FLAGS_clock, clock_overhead_nanos());
+  fprintf(stderr, "Storage:    %s%s\n", FLAGS_storage,
+          FLAGS_direct_io ? " (O_DIRECT)" :
+          !FLAGS_io_uring ? "" :
+          FLAGS_io_uring_registered ? " (io_uring, registered buffers)" :
+          " (io_uring)");
+  if (FLAGS_mmap_size >= 0) {
+    fprintf(stderr, "Mmap:       %" PRId64 " bytes, madvise %s\n",
+            FLAGS_mmap_size, FLAGS_madvise);
+  }
+  if (strcmp(FLAGS_sqlite_malloc, "system")) {
+    fprintf(stderr, "Malloc:     %s (%.1f MB heap)\n", FLAGS_sqlite_malloc,
+            FLAGS_heap_size / 1048576.0);
+  }
+  if (FLAGS_lookaside_size >= 0 || FLAGS_lookaside_count >= 0) {
+    fprintf(stderr, "Lookaside:  %d slots of %d bytes\n",
+            FLAGS_lookaside_count >= 0 ? FLAGS_lookaside_count : 100,
+            FLAGS_lookaside_size >= 0 ? FLAGS_lookaside_size : 1200);
+  }
+  fprintf(stderr, "Threading:  %s, open mutex %s\n", FLAGS_threading,
+          FLAGS_open_mutex);
+  if (!strcmp(FLAGS_pcache, "hugepage")) {
+    fprintf(stderr, "Pcache:     hugepage (%s)\n", pcache_hugepage_source());
+  } else if (strcmp(FLAGS_pcache, "default")) {
+    fprintf(stderr, "Pcache:     %s\n", FLAGS_pcache);
+  }
+  if (vfs_delay_enabled()) {
+    fprintf(stderr, "IODelay:    read %s, write %s, sync %s",
+            FLAGS_read_delay ? FLAGS_read_delay : "none",
+            FLAGS_write_delay ? FLAGS_write_delay : "none",
+            FLAGS_sync_delay ? FLAGS_sync_delay : "none");
+    if (FLAGS_io_throughput > 0) {
+      fprintf(stderr, ", %.1f MB/s", FLAGS_io_throughput);
+    }
+    fprintf(stderr, "\n");
+  }
   fprintf(stderr, "RawSize:    %.1f MB (estimated)\n",
             (((int64_t)(kKeySize + FLAGS_value_size) * num_)
             / 1048576.0));
@@ -99,9 +261,20 @@ static void print_warnings() {
 
 static void print_environment() {
   fprintf(stderr, "SQLite:     version %s\n", SQLITE_VERSION);
+  if (report_enabled()) {
+    report_begin_object("environment");
+    report_string("sqlite_version", SQLITE_VERSION);
+    report_string("sqlite_source_id", sqlite3_sourceid());
+  }
 #if defined(__linux)
   time_t now = time(NULL);
   fprintf(stderr, "Date:       %s", ctime(&now));
+  if (report_enabled()) {
+    char date[64];
+    snprintf(date, sizeof(date), "%s", ctime(&now));
+    date[strcspn(date, "\n")] = '\0';
+    report_string("date", date);
+  }
 
   FILE* cpuinfo = fopen("/proc/cpuinfo", "r");
   if (cpuinfo != NULL) {
@@ -134,66 +307,334 @@ static void print_environment() {
     fclose(cpuinfo);
     fprintf(stderr, "CPU:        %d * %s\n", num_cpus, cpu_type);
     fprintf(stderr, "CPUCache:   %s\n", cache_size);
+    if (report_enabled()) {
+      report_int("num_cpus", num_cpus);
+      report_string("cpu", cpu_type);
+      report_string("cpu_cache", cache_size);
+    }
     free(cpu_type);
     free(cache_size);
   }
 #endif
+  if (report_enabled()) report_end_object();
 }
 
-static void start() {
-  start_ =  now_micros() * 1e-6;
-  bytes_ = 0;
-  message_ = malloc(sizeof(char) * 10000);
-  strcpy(message_, "");
-  last_op_finish_ = start_;
-  histogram_clear(&hist_);
-  raw_clear(&raw_);
-  done_ = 0;
-  next_report_ = 100;
+/* Wall-clock seconds from the first start to the last finish */
+static double stats_elapsed(const Stats* stats) {
+  return (stats->finish_ - stats->start_) * 1e-9;
 }
 
-void finished_single_op() {
-  if (FLAGS_histogram || FLAGS_raw) {
-    double now = now_micros() * 1e-6;
-    double micros = (now - last_op_finish_) * 1e6;
-    if (FLAGS_histogram) {
-      histogram_add(&hist_, micros);
-      if (micros > 20000) {
-        fprintf(stderr, "long op: %.1f micros%30s\r", micros, "");
-        fflush(stderr);
-      }
+/* Effective value of every flag, for --report */
+static void report_flags() {
+  report_begin_object("flags");
+  report_string("benchmarks", FLAGS_benchmarks);
+  report_int("num", FLAGS_num);
+  report_int("reads", FLAGS_reads);
+  report_int("value_size", FLAGS_value_size);
+  report_bool("histogram", FLAGS_histogram);
+  report_int("histogram_digits", FLAGS_histogram_digits);
+  report_bool("raw", FLAGS_raw);
+  report_double("compression_ratio", FLAGS_compression_ratio);
+  report_int("page_size", FLAGS_page_size);
+  report_int("num_pages", FLAGS_num_pages);
+  report_bool("use_existing_db", FLAGS_use_existing_db);
+  report_bool("transaction", FLAGS_transaction);
+  report_bool("WAL_enabled", FLAGS_WAL_enabled);
+  report_string("db", FLAGS_db);
+  report_string("storage", FLAGS_storage);
+  report_bool("io_uring", FLAGS_io_uring);
+  report_bool("io_uring_registered", FLAGS_io_uring_registered);
+  report_bool("direct_io", FLAGS_direct_io);
+  report_int("mmap_size", FLAGS_mmap_size);
+  report_string("madvise", FLAGS_madvise);
+  report_bool("fault_stats", FLAGS_fault_stats);
+  report_string("pcache", FLAGS_pcache);
+  report_int("threads", FLAGS_threads);
+  report_int("scan_length", FLAGS_scan_length);
+  report_double("target_rate", FLAGS_target_rate);
+  report_string("arrival", FLAGS_arrival);
+  report_string("key_dist", FLAGS_key_dist);
+  report_double("zipf_theta", FLAGS_zipf_theta);
+  report_double("hotspot_ops_fraction", FLAGS_hotspot_ops_fraction);
+  report_double("hotspot_keys_fraction", FLAGS_hotspot_keys_fraction);
+  report_string("clock", FLAGS_clock);
+  report_string("workload", FLAGS_workload);
+  report_string("replay", FLAGS_replay);
+  report_string("replay_db", FLAGS_replay_db);
+  report_double("replay_speed", FLAGS_replay_speed);
+  report_string("trace_out", FLAGS_trace_out);
+  report_bool("alloc_stats", FLAGS_alloc_stats);
+  report_string("sqlite_malloc", FLAGS_sqlite_malloc);
+  report_int("heap_size", FLAGS_heap_size);
+  report_int("lookaside_size", FLAGS_lookaside_size);
+  report_int("lookaside_count", FLAGS_lookaside_count);
+  report_string("threading", FLAGS_threading);
+  report_string("open_mutex", FLAGS_open_mutex);
+  report_bool("mutex_stats", FLAGS_mutex_stats);
+  report_bool("vfs_stats", FLAGS_vfs_stats);
+  report_string("read_delay", FLAGS_read_delay);
+  report_string("write_delay", FLAGS_write_delay);
+  report_string("sync_delay", FLAGS_sync_delay);
+  report_double("io_throughput", FLAGS_io_throughput);
+  report_double("stats_interval", FLAGS_stats_interval);
+  report_string("stats_format", FLAGS_stats_format);
+  report_string("stats_file", FLAGS_stats_file);
+  report_string("histogram_out", FLAGS_histogram_out);
+  report_int("raw_sample", FLAGS_raw_sample);
+  report_double("raw_threshold", FLAGS_raw_threshold);
+  report_string("raw_file", FLAGS_raw_file);
+  report_end_object();
+}
+
+/* Current value of the PRAGMAs the benchmarks set, for --report */
+static void report_pragmas(sqlite3* db) {
+  static const char* pragmas[] = {
+    "page_size", "cache_size", "journal_mode", "locking_mode",
+    "synchronous", "wal_autocheckpoint", "mmap_size", NULL
+  };
+  report_begin_object("pragmas");
+  for (int i = 0; db != NULL && pragmas[i] != NULL; i++) {
+    char sql[100];
+    sqlite3_stmt* stmt;
+    snprintf(sql, sizeof(sql), "PRAGMA %s", pragmas[i]);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) continue;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+      report_string(pragmas[i], (const char*)sqlite3_column_text(stmt, 0));
     }
-    if (FLAGS_raw) {
-      raw_add(&raw_, micros);
+    sqlite3_finalize(stmt);
+  }
+  report_end_object();
+}
+
+/* One entry of the --report "benchmarks" array */
+static void report_stats(Stats* stats, const char* name) {
+  double elapsed = stats_elapsed(stats);
+  report_begin_object(NULL);
+  report_string("name", name);
+  report_int("threads", stats->threads_);
+  report_int("ops", stats->done_);
+  report_double("elapsed_seconds", elapsed);
+  report_double("micros_per_op", stats->seconds_ * 1e6 / stats->done_);
+  report_double("ops_per_sec", stats->done_ / elapsed);
+  report_double("mb_per_sec", (stats->bytes_ / 1048576.0) / elapsed);
+  report_int("bytes", stats->bytes_);
+  report_int("rows", stats->rows_);
+  if (FLAGS_alloc_stats) {
+    report_double("harness_allocs_per_op",
+                  (double)stats->harness_allocs_ / stats->done_);
+    report_double("sqlite_allocs_per_op",
+                  (double)stats->sqlite_allocs_ / stats->done_);
+    report_double("sqlite_alloc_nanos_per_op",
+                  (double)stats->sqlite_alloc_nanos_ / stats->done_);
+    report_int("lookaside_hits", stats->lookaside_hits_);
+    report_int("lookaside_misses", stats->lookaside_misses_);
+    sqlite3_int64 used, peak;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &peak, 0);
+    report_int("sqlite_memory_used", used);
+    report_int("sqlite_memory_peak", peak);
+    if (!strcmp(FLAGS_sqlite_malloc, "pool")) {
+      report_int("pool_fallbacks", stats->pool_fallbacks_);
+    }
+  }
+  if (FLAGS_fault_stats) {
+    report_double("minor_faults_per_op",
+                  (double)stats->minor_faults_ / stats->done_);
+    report_double("major_faults_per_op",
+                  (double)stats->major_faults_ / stats->done_);
+  }
+  if (FLAGS_mutex_stats) {
+    report_double("mutex_enters_per_op",
+                  (double)stats->mutex_enters_ / stats->done_);
+    report_double("mutex_nanos_per_op",
+                  (double)stats->mutex_nanos_ / stats->done_);
+  }
+  if (strcmp(FLAGS_pcache, "default")) {
+    int64_t peak;
+    int64_t footprint = pcache_footprint(&peak);
+    report_begin_object("pcache");
+    report_int("hits", stats->pcache_hits_);
+    report_int("misses", stats->pcache_misses_);
+    report_int("evictions", stats->pcache_evictions_);
+    report_int("footprint_bytes", footprint);
+    report_int("peak_footprint_bytes", peak);
+    report_end_object();
+  }
+  report_pragmas(db_);
+  if (FLAGS_vfs_stats) {
+    vfs_stats_report(stats->bytes_);
+  }
+  if (stats->hist_.num_ > 0) {
+    report_histogram("histogram", &stats->hist_);
+  }
+  if (stats->service_hist_.num_ > 0) {
+    report_histogram("service_histogram", &stats->service_hist_);
+  }
+  if (replay_merged_ != NULL) {
+    report_begin_array("statements");
+    for (int i = 0; i < trace_.num_fingerprints_; i++) {
+      if (replay_merged_[i].num_ == 0) continue;
+      report_begin_object(NULL);
+      report_string("fingerprint", trace_.fingerprints_[i]);
+      report_int("errors", replay_merged_errors_[i]);
+      report_histogram("histogram", &replay_merged_[i]);
+      report_end_object();
+    }
+    report_end_array();
+  }
+  report_begin_object("ops_by_type");
+  for (int i = 0; i < kNumOpTypes; i++) {
+    if (stats->op_done_[i] == 0) continue;
+    report_begin_object(op_type_names[i]);
+    report_int("ops", stats->op_done_[i]);
+    if (stats->op_hist_[i].num_ > 0) {
+      report_histogram("histogram", &stats->op_hist_[i]);
     }
-    last_op_finish_ = now;
+    report_end_object();
   }
+  report_end_object();
+  report_end_object();
+}
 
-  done_++;
-  if (done_ >= next_report_) {
-    if      (next_report_ < 1000)   next_report_ += 100;
-    else if (next_report_ < 5000)   next_report_ += 500;
-    else if (next_report_ < 10000)  next_report_ += 1000;
-    else if (next_report_ < 50000)  next_report_ += 5000;
-    else if (next_report_ < 100000) next_report_ += 10000;
-    else if (next_report_ < 500000) next_report_ += 50000;
-    else                            next_report_ += 100000;
-    fprintf(stderr, "... finished %d ops%30s\r", done_, "");
-    fflush(stderr);
+/* Empty stats that own no memory yet, to merge other stats into */
+static void stats_init(Stats* stats) {
+  memset(stats, 0, sizeof(Stats));
+  stats->start_ = UINT64_MAX;
+  histogram_clear(&stats->hist_);
+  histogram_clear(&stats->service_hist_);
+  for (int i = 0; i < kNumOpTypes; i++) {
+    histogram_clear(&stats->op_hist_[i]);
+  }
+  histogram_clear(&stats->interval_hist_);
+  raw_clear(&stats->raw_, 301);
+}
+
+static void stats_free(Stats* stats) {
+  histogram_free(&stats->hist_);
+  histogram_free(&stats->service_hist_);
+  for (int i = 0; i < kNumOpTypes; i++) {
+    histogram_free(&stats->op_hist_[i]);
+  }
+  histogram_free(&stats->interval_hist_);
+  raw_free(&stats->raw_);
+}
+
+static void stats_start(Stats* stats, int tid) {
+  stats->start_ = now_nanos();
+  stats->finish_ = stats->start_;
+  stats->seconds_ = 0;
+  stats->last_op_finish_ = stats->start_;
+  stats->next_arrival_ = stats->start_;
+  stats->bytes_ = 0;
+  stats->rows_ = 0;
+  stats->op_unit_ = NULL;
+  histogram_clear(&stats->hist_);
+  histogram_clear(&stats->service_hist_);
+  for (int i = 0; i < kNumOpTypes; i++) {
+    histogram_clear(&stats->op_hist_[i]);
+    stats->op_done_[i] = 0;
   }
+  /* Seeded per thread like the key generators in thread_init() */
+  raw_clear(&stats->raw_, 301 + tid);
+  stats->done_ = 0;
+  stats->threads_ = 1;
+  stats->next_report_ = 100;
+  stats->interval_start_ = stats->start_;
+  stats->interval_done_ = 0;
+  stats->interval_bytes_ = 0;
+  histogram_clear(&stats->interval_hist_);
+  stats->harness_allocs_ = alloc_count_harness();
+  stats->sqlite_allocs_ = alloc_count_sqlite();
+  stats->sqlite_alloc_nanos_ = alloc_nanos_sqlite();
+  stats->lookaside_hits_ = 0;
+  stats->lookaside_misses_ = 0;
+  stats->pool_fallbacks_ = pool_fallback_count();
+  stats->mutex_enters_ = mutex_count_enters();
+  stats->mutex_nanos_ = mutex_nanos();
+  thread_faults(&stats->minor_faults_, &stats->major_faults_);
+  pcache_counts(&stats->pcache_hits_, &stats->pcache_misses_,
+                &stats->pcache_evictions_);
+}
+
+static void stats_stop(Stats* stats) {
+  stats->finish_ = now_nanos();
+  stats->seconds_ = (stats->finish_ - stats->start_) * 1e-9;
+  stats->harness_allocs_ = alloc_count_harness() - stats->harness_allocs_;
+  stats->sqlite_allocs_ = alloc_count_sqlite() - stats->sqlite_allocs_;
+  stats->sqlite_alloc_nanos_ = alloc_nanos_sqlite() - stats->sqlite_alloc_nanos_;
+  stats->pool_fallbacks_ = pool_fallback_count() - stats->pool_fallbacks_;
+  stats->mutex_enters_ = mutex_count_enters() - stats->mutex_enters_;
+  stats->mutex_nanos_ = mutex_nanos() - stats->mutex_nanos_;
+  int64_t minor, major;
+  thread_faults(&minor, &major);
+  stats->minor_faults_ = minor - stats->minor_faults_;
+  stats->major_faults_ = major - stats->major_faults_;
+  int64_t hits, misses, evictions;
+  pcache_counts(&hits, &misses, &evictions);
+  stats->pcache_hits_ = hits - stats->pcache_hits_;
+  stats->pcache_misses_ = misses - stats->pcache_misses_;
+  stats->pcache_evictions_ = evictions - stats->pcache_evictions_;
 }
 
-static void stop(const char* name) {
-  double finish = now_micros() * 1e-6;
+static void stats_merge(Stats* stats, const Stats* other) {
+  histogram_merge(&stats->hist_, &other->hist_);
+  histogram_merge(&stats->service_hist_, &other->service_hist_);
+  for (int i = 0; i < kNumOpTypes; i++) {
+    histogram_merge(&stats->op_hist_[i], &other->op_hist_[i]);
+    stats->op_done_[i] += other->op_done_[i];
+  }
+  raw_merge(&stats->raw_, &other->raw_);
+  stats->done_ += other->done_;
+  stats->threads_ += other->threads_;
+  stats->bytes_ += other->bytes_;
+  stats->rows_ += other->rows_;
+  stats->harness_allocs_ += other->harness_allocs_;
+  stats->sqlite_allocs_ += other->sqlite_allocs_;
+  stats->sqlite_alloc_nanos_ += other->sqlite_alloc_nanos_;
+  stats->lookaside_hits_ += other->lookaside_hits_;
+  stats->lookaside_misses_ += other->lookaside_misses_;
+  stats->pool_fallbacks_ += other->pool_fallbacks_;
+  stats->mutex_enters_ += other->mutex_enters_;
+  stats->mutex_nanos_ += other->mutex_nanos_;
+  stats->minor_faults_ += other->minor_faults_;
+  stats->major_faults_ += other->major_faults_;
+  stats->pcache_hits_ += other->pcache_hits_;
+  stats->pcache_misses_ += other->pcache_misses_;
+  stats->pcache_evictions_ += other->pcache_evictions_;
+  stats->seconds_ += other->seconds_;
+  if (stats->op_unit_ == NULL) stats->op_unit_ = other->op_unit_;
+  if (other->start_ < stats->start_) stats->start_ = other->start_;
+  if (other->finish_ > stats->finish_) stats->finish_ = other->finish_;
+}
 
-  if (done_ < 1) done_ = 1;
+static void stats_report(Stats* stats, const char* name) {
+  /* Pretend at least one op was done in case we are running a benchmark
+   * that does not call finished_single_op(). */
+  if (stats->done_ < 1) stats->done_ = 1;
 
-  if (bytes_ > 0) {
-    char *rate = malloc(sizeof(char) * 100);;
-    snprintf(rate, strlen(rate), "%6.1f MB/s",
-              (bytes_ / 1048576.0) / (finish - start_));
-    if (message_ && !strcmp(message_, "")) {
-      message_ = strcat(strcat(rate, " "), message_);
+  if (stats->bytes_ > 0 || stats->rows_ > 0 || stats->op_unit_ != NULL) {
+    /* Rate is computed on actual elapsed time, not the sum of per-thread
+     * elapsed times. */
+    double elapsed = stats_elapsed(stats);
+    char *rate = malloc(sizeof(char) * 100);
+    strcpy(rate, "");
+    if (stats->bytes_ > 0) {
+      snprintf(rate, 100, "%6.1f MB/s",
+                (stats->bytes_ / 1048576.0) / elapsed);
+    }
+    if (stats->op_unit_ != NULL) {
+      snprintf(rate + strlen(rate), 100 - strlen(rate), "%s%.0f %s/s",
+                strcmp(rate, "") ? " " : "", stats->done_ / elapsed,
+                stats->op_unit_);
+    }
+    if (stats->rows_ > 0) {
+      snprintf(rate + strlen(rate), 100 - strlen(rate), "%s%.0f rows/s",
+                strcmp(rate, "") ? " " : "", stats->rows_ / elapsed);
+    }
+    if (message_ && strcmp(message_, "")) {
+      char *msg = malloc(strlen(rate) + strlen(message_) + 2);
+      sprintf(msg, "%s %s", rate, message_);
+      free(rate);
+      message_ = msg;
     } else {
       message_ = rate;
     }
@@ -201,155 +642,315 @@ static void stop(const char* name) {
 
   fprintf(stderr, "%-12s : %11.3f micros/op;%s%s\n",
           name,
-          (finish - start_) * 1e6 / done_,
+          stats->seconds_ * 1e6 / stats->done_,
           (!message_ || !strcmp(message_, "") ? "" : " "),
           (!message_) ? "" : message_);
+  /* Break down mixed workloads by operation type */
+  int num_op_types = 0;
+  for (int i = 0; i < kNumOpTypes; i++) {
+    if (stats->op_done_[i] > 0) num_op_types++;
+  }
+  for (int i = 0; num_op_types > 1 && i < kNumOpTypes; i++) {
+    Histogram* hist = &stats->op_hist_[i];
+    if (stats->op_done_[i] == 0) continue;
+    fprintf(stderr, "  %-15s : %11" PRId64 " ops", op_type_names[i],
+            stats->op_done_[i]);
+    if (hist->num_ > 0) {
+      fprintf(stderr, "; %9.3f micros/op; p50 %.3f p99 %.3f p99.9 %.3f",
+              hist->sum_ / hist->num_ * 1e-3,
+              histogram_percentile(hist, 50.0) * 1e-3,
+              histogram_percentile(hist, 99.0) * 1e-3,
+              histogram_percentile(hist, 99.9) * 1e-3);
+    }
+    fprintf(stderr, "\n");
+  }
+  if (FLAGS_alloc_stats) {
+    int outstanding, peak;
+    sqlite3_status(SQLITE_STATUS_MALLOC_COUNT, &outstanding, &peak, 0);
+    fprintf(stderr, "  %-15s : %11.3f harness %.3f sqlite; "
+            "sqlite outstanding %d peak %d\n", "allocs/op",
+            (double)stats->harness_allocs_ / stats->done_,
+            (double)stats->sqlite_allocs_ / stats->done_,
+            outstanding, peak);
+    int64_t lookaside = stats->lookaside_hits_ + stats->lookaside_misses_;
+    fprintf(stderr, "  %-15s : %11.1f ns/op in the allocator; lookaside %"
+            PRId64 " hits %" PRId64 " misses (%.1f%%)\n", "sqlite malloc",
+            (double)stats->sqlite_alloc_nanos_ / stats->done_,
+            stats->lookaside_hits_, stats->lookaside_misses_,
+            lookaside > 0 ? 100.0 * stats->lookaside_hits_ / lookaside : 0.0);
+    sqlite3_int64 used, high;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &used, &high, 0);
+    fprintf(stderr, "  %-15s : %11.1f MB used, peak %.1f MB", "sqlite memory",
+            used / 1048576.0, high / 1048576.0);
+    if (!strcmp(FLAGS_sqlite_malloc, "pool")) {
+      fprintf(stderr, "; %" PRId64 " pool fallbacks", stats->pool_fallbacks_);
+    }
+    fprintf(stderr, "\n");
+  }
+  if (FLAGS_fault_stats) {
+    fprintf(stderr, "  %-15s : %11.3f minor %.3f major\n", "faults/op",
+            (double)stats->minor_faults_ / stats->done_,
+            (double)stats->major_faults_ / stats->done_);
+  }
+  if (FLAGS_mutex_stats) {
+    fprintf(stderr, "  %-15s : %11.3f enters %.1f ns\n", "mutex/op",
+            (double)stats->mutex_enters_ / stats->done_,
+            (double)stats->mutex_nanos_ / stats->done_);
+  }
+  if (strcmp(FLAGS_pcache, "default")) {
+    int64_t peak;
+    int64_t footprint = pcache_footprint(&peak);
+    int64_t fetches = stats->pcache_hits_ + stats->pcache_misses_;
+    fprintf(stderr, "  %-15s : %11" PRId64 " hits %" PRId64 " misses %"
+            PRId64 " evictions; hit rate %.1f%%; %.1f MB peak %.1f MB\n",
+            "pcache", stats->pcache_hits_, stats->pcache_misses_,
+            stats->pcache_evictions_,
+            fetches > 0 ? 100.0 * stats->pcache_hits_ / fetches : 0.0,
+            footprint / 1048576.0, peak / 1048576.0);
+  }
+  if (FLAGS_vfs_stats) {
+    vfs_stats_print(stderr, stats->bytes_);
+  }
+
   if (FLAGS_raw) {
-    raw_print(stdout, &raw_);
+    raw_print(stdout, &stats->raw_);
+  }
+  if (report_enabled()) {
+    report_stats(stats, name);
+  }
+  if (FLAGS_histogram_out) {
+    FILE* f = fopen(FLAGS_histogram_out, "a");
+    if (!f) {
+      fprintf(stderr, "cannot open %s\n", FLAGS_histogram_out);
+      exit(1);
+    }
+    histogram_write(f, name, &stats->hist_);
+    fclose(f);
   }
-  if (FLAGS_histogram) {
-    fprintf(stderr, "Microseconds per op:\n%s\n",
-            histogram_to_string(&hist_));
+  if (FLAGS_histogram && FLAGS_target_rate > 0) {
+    fprintf(stderr, "Response time, nanoseconds per op:\n%s\n",
+            histogram_to_string(&stats->hist_));
+    fprintf(stderr, "Service time, nanoseconds per op:\n%s\n",
+            histogram_to_string(&stats->service_hist_));
+  } else if (FLAGS_histogram) {
+    fprintf(stderr, "Nanoseconds per op:\n%s\n",
+            histogram_to_string(&stats->hist_));
   }
   fflush(stdout);
   fflush(stderr);
 }
 
-void benchmark_init() {
-  db_ = NULL;
-  db_num_ = 0;
-  num_ = FLAGS_num;
-  reads_ = FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads;
-  bytes_ = 0;
-  rand_gen_init(&gen_, FLAGS_compression_ratio);
-  rand_init(&rand_, 301);;
+static void start(ThreadState* thread) {
+  message_ = malloc(sizeof(char) * 10000);
+  strcpy(message_, "");
+  if (FLAGS_vfs_stats) vfs_stats_reset();
+  pcache_reset_peak();
+  if (FLAGS_alloc_stats) alloc_reset_peak();
+  stats_start(&thread->stats_, thread->tid_);
+  if (FLAGS_alloc_stats && thread->db_ != NULL) lookaside_reset(thread->db_);
+}
 
-  struct dirent* ep;
-  DIR* test_dir = opendir(FLAGS_db);
-  if (!FLAGS_use_existing_db) {
-    while ((ep = readdir(test_dir)) != NULL) {
-      if (starts_with(ep->d_name, "dbbench_sqlite3")) {
-        char file_name[1000];
-        strcpy(file_name, FLAGS_db);
-        strcat(file_name, ep->d_name);
-        remove(file_name);
-      }
+/*
+ * In open-loop mode (--target_rate) wait for the next scheduled arrival
+ * before issuing an op.  An op that falls behind schedule is issued at
+ * once and the delay is charged to its response time.
+ */
+static void start_single_op(ThreadState* thread) {
+  if (thread->arrival_interval_ <= 0) return;
+
+  Stats* stats = &thread->stats_;
+  uint64_t now = now_nanos();
+  stats->op_scheduled_ = (uint64_t)stats->next_arrival_;
+  while (now < stats->op_scheduled_) {
+    /* Sleep for the bulk of the wait and spin for the rest */
+    uint64_t wait = stats->op_scheduled_ - now;
+    if (wait > 200000) {
+      sleep_micros((wait - 100000) / 1000);
     }
+    now = now_nanos();
   }
-  closedir(test_dir);
+  stats->op_start_ = now;
+
+  double interval = thread->arrival_interval_;
+  if (poisson_arrival_) {
+    interval *= -log(rand_next(&thread->arrival_rand_) / 2147483647.0);
+  }
+  stats->next_arrival_ += interval;
 }
 
-void benchmark_fini() {
-  int status = sqlite3_close(db_);
-  error_check(status);
+/*
+ * Emit one --stats_interval sample covering the ops finished since the
+ * previous sample, and start the next one at now.
+ */
+static void stats_interval_report(ThreadState* thread, uint64_t now) {
+  Stats* stats = &thread->stats_;
+  double seconds = (now - stats->interval_start_) * 1e-9;
+  int ops = stats->done_ - stats->interval_done_;
+  double mb = (stats->bytes_ - stats->interval_bytes_) / 1048576.0;
+  double p50 = histogram_percentile(&stats->interval_hist_, 50.0) * 1e-3;
+  double p99 = histogram_percentile(&stats->interval_hist_, 99.0) * 1e-3;
+  if (seconds <= 0) return;
+
+  pthread_mutex_lock(&stats_file_mu_);
+  if (!strcmp(FLAGS_stats_format, "json")) {
+    fprintf(stats_file_,
+            "{\"benchmark\": \"%s\", \"thread\": %d, \"time\": %.3f, "
+            "\"ops\": %d, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f, "
+            "\"p50_micros\": %.3f, \"p99_micros\": %.3f}\n",
+            benchmark_name_, thread->tid_, (now - stats->start_) * 1e-9,
+            ops, ops / seconds, mb / seconds, p50, p99);
+  } else {
+    fprintf(stats_file_, "%s,%d,%.3f,%d,%.1f,%.3f,%.3f,%.3f\n",
+            benchmark_name_, thread->tid_, (now - stats->start_) * 1e-9,
+            ops, ops / seconds, mb / seconds, p50, p99);
+  }
+  fflush(stats_file_);
+  pthread_mutex_unlock(&stats_file_mu_);
+
+  stats->interval_start_ = now;
+  stats->interval_done_ = stats->done_;
+  stats->interval_bytes_ = stats->bytes_;
+  histogram_clear(&stats->interval_hist_);
 }
 
-void benchmark_run() {
-  print_header();
-  benchmark_open();
+/* Emit the partial sample left when a benchmark thread stops */
+static void stats_interval_finish(ThreadState* thread) {
+  Stats* stats = &thread->stats_;
+  if (FLAGS_stats_interval > 0 && stats->done_ > stats->interval_done_) {
+    stats_interval_report(thread, stats->finish_);
+  }
+}
 
-  char* benchmarks = FLAGS_benchmarks;
-  while (benchmarks != NULL) {
-    char* sep = strchr(benchmarks, ',');
-    char* name;
-    if (sep == NULL) {
-      name = benchmarks;
-      benchmarks = NULL;
-    } else {
-      name = calloc(sizeof(char), (sep - benchmarks + 1));
-      strncpy(name, benchmarks, sep - benchmarks);
-      benchmarks = sep + 1;
+void finished_single_op(ThreadState* thread, int op_type) {
+  Stats* stats = &thread->stats_;
+  bool open_loop = (thread->arrival_interval_ > 0);
+  uint64_t now = 0;
+  if (FLAGS_histogram || FLAGS_raw || thread->measure_latency_ || open_loop ||
+      FLAGS_stats_interval > 0 || raw_log_enabled()) {
+    now = now_nanos();
+    double nanos = (double)(now - stats->last_op_finish_);
+    if (open_loop) {
+      /* Measure from the scheduled start so that the queueing delay
+       * behind a stalled op is not omitted. */
+      nanos = (double)(now - stats->op_scheduled_);
+      histogram_add(&stats->service_hist_, (double)(now - stats->op_start_));
     }
-    bytes_ = 0;
-    start();
-    bool known = true;
-    bool write_sync = false;
-    if (!strcmp(name, "fillseq")) {
-      benchmark_write(write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseqbatch")) {
-      benchmark_write(write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandom")) {
-      benchmark_write(write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandbatch")) {
-      benchmark_write(write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "overwrite")) {
-      benchmark_write(write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "overwritebatch")) {
-      benchmark_write(write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandsync")) {
-      write_sync = true;
-      benchmark_write(write_sync, RANDOM, FRESH, num_ / 100, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseqsync")) {
-      write_sync = true;
-      benchmark_write(write_sync, SEQUENTIAL, FRESH, num_ / 100, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrand100K")) {
-      benchmark_write(write_sync, RANDOM, FRESH, num_ / 1000, 100 * 1000, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseq100K")) {
-      benchmark_write(write_sync, SEQUENTIAL, FRESH, num_ / 1000, 100 * 1000, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "readseq")) {
-      benchmark_read(SEQUENTIAL, 1);
-    } else if (!strcmp(name, "readrandom")) {
-      benchmark_read(RANDOM, 1);
-    } else if (!strcmp(name, "readrand100K")) {
-      int n = reads_;
-      reads_ /= 1000;
-      benchmark_read(RANDOM, 1);
-      reads_ = n;
-    } else {
-      known = false;
-      if (strcmp(name, "")) {
-        fprintf(stderr, "unknown benchmark '%s'\n", name);
+    if (FLAGS_histogram || thread->measure_latency_) {
+      histogram_add(&stats->hist_, nanos);
+      histogram_add(&stats->op_hist_[op_type], nanos);
+    }
+    if (FLAGS_histogram) {
+      if (nanos > 20000000) {
+        fprintf(stderr, "long op: %.1f micros%30s\r", nanos * 1e-3, "");
+        fflush(stderr);
       }
     }
-    if (known) {
-      stop(name);
+    if (FLAGS_raw) {
+      raw_add(&stats->raw_, nanos);
+    }
+    if (raw_log_enabled()) {
+      raw_log_add(&thread->raw_log_, thread->tid_, op_type, thread->key_,
+                  now, (uint64_t)nanos);
     }
+    if (FLAGS_stats_interval > 0) {
+      histogram_add(&stats->interval_hist_, nanos);
+    }
+    stats->last_op_finish_ = now;
   }
-}
 
-void benchmark_open() {
-  assert(db_ == NULL);
+  thread->key_ = -1;
+  stats->done_++;
+  stats->op_done_[op_type]++;
+  if (FLAGS_stats_interval > 0 &&
+      now - stats->interval_start_ >= FLAGS_stats_interval * 1e9) {
+    stats_interval_report(thread, now);
+  }
+  if (stats->done_ >= stats->next_report_) {
+    if      (stats->next_report_ < 1000)   stats->next_report_ += 100;
+    else if (stats->next_report_ < 5000)   stats->next_report_ += 500;
+    else if (stats->next_report_ < 10000)  stats->next_report_ += 1000;
+    else if (stats->next_report_ < 50000)  stats->next_report_ += 5000;
+    else if (stats->next_report_ < 100000) stats->next_report_ += 10000;
+    else if (stats->next_report_ < 500000) stats->next_report_ += 50000;
+    else                                   stats->next_report_ += 100000;
+    fprintf(stderr, "... finished %d ops%30s\r", stats->done_, "");
+    fflush(stderr);
+  }
+}
 
-  int status;
-  char file_name[100];
-  char* err_msg = NULL;
-  db_num_++;
+static void stop(ThreadState* thread, const char* name) {
+  stats_stop(&thread->stats_);
+  if (FLAGS_alloc_stats && thread->db_ != NULL) {
+    lookaside_counts(thread->db_, &thread->stats_.lookaside_hits_,
+                     &thread->stats_.lookaside_misses_);
+  }
+  stats_interval_finish(thread);
+  if (raw_log_enabled()) raw_log_flush(&thread->raw_log_);
+  stats_report(&thread->stats_, name);
+}
 
-  /* Open database */
+/* Name of the database file currently under benchmark */
+static void db_file_name(char* file_name, size_t size) {
   char *tmp_dir = FLAGS_db;
-  snprintf(file_name, sizeof(file_name),
+  if (FLAGS_replay_db != NULL) {
+    snprintf(file_name, size, "%s", FLAGS_replay_db);
+    return;
+  }
+  snprintf(file_name, size,
             "%sdbbench_sqlite3-%d.db",
             tmp_dir,
             db_num_);
-  status = sqlite3_open(file_name, &db_);
+}
+
+/* Open another connection to the current database, configured the same
+ * way as the one opened by benchmark_open(). */
+static sqlite3* open_connection(void) {
+  sqlite3* db = NULL;
+  int status;
+  char file_name[1024];
+  char* err_msg = NULL;
+
+  db_file_name(file_name, sizeof(file_name));
+  status = sqlite3_open_v2(file_name, &db,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                             open_mutex_flags(FLAGS_open_mutex),
+                           NULL);
   if (status) {
-    fprintf(stderr, "open error: %s\n", sqlite3_errmsg(db_));
+    fprintf(stderr, "open error: %s\n", sqlite3_errmsg(db));
     exit(1);
   }
 
+  /* Resize lookaside before anything is allocated from it */
+  if (FLAGS_lookaside_size >= 0 || FLAGS_lookaside_count >= 0) {
+    status = sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, NULL,
+                               FLAGS_lookaside_size >= 0 ?
+                                 FLAGS_lookaside_size : 1200,
+                               FLAGS_lookaside_count >= 0 ?
+                                 FLAGS_lookaside_count : 100);
+    error_check(status);
+  }
+
   /* Change SQLite cache size */
   char cache_size[100];
   snprintf(cache_size, sizeof(cache_size), "PRAGMA cache_size = %d",
             FLAGS_num_pages);
-  status = sqlite3_exec(db_, cache_size, NULL, NULL, &err_msg);
+  status = sqlite3_exec(db, cache_size, NULL, NULL, &err_msg);
   exec_error_check(status, err_msg);
 
+  if (FLAGS_mmap_size >= 0) {
+    char mmap_size[100];
+    snprintf(mmap_size, sizeof(mmap_size), "PRAGMA mmap_size = %" PRId64,
+              FLAGS_mmap_size);
+    status = sqlite3_exec(db, mmap_size, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+
   /* FLAGS_page_size is defaulted to 1024 */
   if (FLAGS_page_size != 1024) {
     char page_size[100];
     snprintf(page_size, sizeof(page_size), "PRAGMA page_size = %d",
               FLAGS_page_size);
-    status = sqlite3_exec(db_, page_size, NULL, NULL, &err_msg);
+    status = sqlite3_exec(db, page_size, NULL, NULL, &err_msg);
     exec_error_check(status, err_msg);
   }
 
@@ -359,71 +960,916 @@ void benchmark_open() {
 
     /* Default cache size is a combined 4 MB */
     char* WAL_checkpoint = "PRAGMA wal_autocheckpoint = 4096";
-    status = sqlite3_exec(db_, WAL_stmt, NULL, NULL, &err_msg);
+    status = sqlite3_exec(db, WAL_stmt, NULL, NULL, &err_msg);
     exec_error_check(status, err_msg);
-    status = sqlite3_exec(db_, WAL_checkpoint, NULL, NULL, &err_msg);
+    status = sqlite3_exec(db, WAL_checkpoint, NULL, NULL, &err_msg);
     exec_error_check(status, err_msg);
   }
 
-  /* Change locking mode to exclusive and create tables/index for database */
-  char* locking_stmt = "PRAGMA locking_mode = EXCLUSIVE";
-  char* create_stmt =
-          "CREATE TABLE test (key blob, value blob, PRIMARY KEY (key))";
-  char* stmt_array[] = { locking_stmt, create_stmt, NULL };
-  int stmt_array_length = sizeof(stmt_array) / sizeof(char*);
-  for (int i = 0; i < stmt_array_length; i++) {
-    status = sqlite3_exec(db_, stmt_array[i], NULL, NULL, &err_msg);
+  return db;
+}
+
+/* With --trace_out, record every statement db runs from now on */
+static void trace_connection(sqlite3* db) {
+  if (trace_out_ == NULL) return;
+  int status = trace_capture(db, trace_out_);
+  error_check(status);
+}
+
+/*
+ * benchmark_open() takes an exclusive lock on the database.  Release it
+ * so that other connections can get in, or take it back afterwards.  In
+ * WAL mode the exclusive lock keeps the WAL index in heap memory, so the
+ * journal mode has to be cycled before the lock can be dropped.
+ */
+static void share_database(sqlite3* db, bool share) {
+  int status;
+  char* err_msg = NULL;
+  char* share_stmt[] = {
+    FLAGS_WAL_enabled ? "PRAGMA journal_mode = DELETE" : "",
+    "PRAGMA locking_mode = NORMAL",
+    "SELECT 1 FROM test LIMIT 1",
+    FLAGS_WAL_enabled ? "PRAGMA journal_mode = WAL" : "",
+    NULL
+  };
+  char* unshare_stmt[] = { "PRAGMA locking_mode = EXCLUSIVE", NULL };
+  char** stmt_array = share ? share_stmt : unshare_stmt;
+  /* A replay would take the exclusive lock back at once */
+  trace_pause(true);
+  for (int i = 0; stmt_array[i] != NULL; i++) {
+    status = sqlite3_exec(db, stmt_array[i], NULL, NULL, &err_msg);
     exec_error_check(status, err_msg);
   }
+  trace_pause(false);
 }
 
-void benchmark_write(bool write_sync, int order, int state,
-                  int num_entries, int value_size, int entries_per_batch) {
-  /* Create new database if state == FRESH */
-  if (state == FRESH) {
-    if (FLAGS_use_existing_db) {
-      message_ = malloc(sizeof(char) * 100);
-      strcpy(message_, "skipping (--use_existing_db is true)");
-      return;
+static void thread_init(ThreadState* thread, int tid, sqlite3* db) {
+  thread->tid_ = tid;
+  thread->db_ = db;
+  rand_init(&thread->rand_, 1000 + tid);
+  thread->gen_ = gen_;
+  rand_init(&thread->arrival_rand_, 2000 + tid);
+  thread->key_ = -1;
+  thread->arrival_interval_ =
+    (FLAGS_target_rate > 0) ? 1e9 / FLAGS_target_rate : 0;
+}
+
+static void* thread_body(void* v) {
+  ThreadArg* arg = (ThreadArg*)v;
+  SharedState* shared = arg->shared_;
+  ThreadState* thread = arg->thread_;
+
+  pthread_mutex_lock(&shared->mu_);
+  shared->num_initialized_++;
+  if (shared->num_initialized_ >= shared->total_) {
+    pthread_cond_broadcast(&shared->cv_);
+  }
+  while (!shared->start_) {
+    pthread_cond_wait(&shared->cv_, &shared->mu_);
+  }
+  pthread_mutex_unlock(&shared->mu_);
+
+  stats_start(&thread->stats_, thread->tid_);
+  if (FLAGS_alloc_stats) lookaside_reset(thread->db_);
+  (arg->method_)(thread);
+  stats_stop(&thread->stats_);
+  /* A method that closed its connection has taken the counts already */
+  if (FLAGS_alloc_stats && thread->db_ != NULL) {
+    lookaside_counts(thread->db_, &thread->stats_.lookaside_hits_,
+                     &thread->stats_.lookaside_misses_);
+  }
+  stats_interval_finish(thread);
+  if (raw_log_enabled()) raw_log_flush(&thread->raw_log_);
+
+  pthread_mutex_lock(&shared->mu_);
+  shared->num_done_++;
+  if (shared->num_done_ >= shared->total_) {
+    pthread_cond_broadcast(&shared->cv_);
+  }
+  pthread_mutex_unlock(&shared->mu_);
+  return NULL;
+}
+
+/*
+ * Run method on n threads, each with its own connection, Random seed and
+ * Stats.  Returns the finished threads; the caller merges their stats and
+ * releases them with free_threads().
+ */
+static ThreadState* run_threads(int n, void (*method)(ThreadState*)) {
+  SharedState shared;
+  if (n > 1 && !strcmp(FLAGS_threading, "single")) {
+    fprintf(stderr, "--threading=single cannot run %d threads at once\n", n);
+    exit(1);
+  }
+  pthread_mutex_init(&shared.mu_, NULL);
+  pthread_cond_init(&shared.cv_, NULL);
+  shared.total_ = n;
+  shared.num_initialized_ = 0;
+  shared.num_done_ = 0;
+  shared.start_ = false;
+  if (FLAGS_vfs_stats) vfs_stats_reset();
+  pcache_reset_peak();
+  if (FLAGS_alloc_stats) alloc_reset_peak();
+
+  ThreadArg* arg = calloc(n, sizeof(ThreadArg));
+  ThreadState* threads = calloc(n, sizeof(ThreadState));
+  pthread_t* tids = calloc(n, sizeof(pthread_t));
+  for (int i = 0; i < n; i++) {
+    sqlite3* db = open_connection();
+    trace_connection(db);
+    thread_init(&threads[i], i, db);
+    /* Each thread schedules its own arrivals at 1/n of the target rate */
+    threads[i].arrival_interval_ *= n;
+    sqlite3_busy_timeout(threads[i].db_, 1000);
+    threads[i].shared_ = &shared;
+    arg[i].shared_ = &shared;
+    arg[i].thread_ = &threads[i];
+    arg[i].method_ = method;
+    if (pthread_create(&tids[i], NULL, thread_body, &arg[i])) {
+      fprintf(stderr, "pthread_create failed\n");
+      exit(1);
     }
-    sqlite3_close(db_);
-    db_ = NULL;
-    benchmark_open();
-    start();
   }
 
-  if (num_entries != num_) {
-    char* msg = malloc(sizeof(char) * 100);
-    snprintf(msg, 100, "(%d ops)", num_entries);
-    message_ = msg;
+  pthread_mutex_lock(&shared.mu_);
+  while (shared.num_initialized_ < n) {
+    pthread_cond_wait(&shared.cv_, &shared.mu_);
+  }
+  shared.start_ = true;
+  pthread_cond_broadcast(&shared.cv_);
+  while (shared.num_done_ < n) {
+    pthread_cond_wait(&shared.cv_, &shared.mu_);
   }
+  pthread_mutex_unlock(&shared.mu_);
 
-  char* err_msg = NULL;
-  int status;
+  for (int i = 0; i < n; i++) {
+    pthread_join(tids[i], NULL);
+    threads[i].shared_ = NULL;
+    int status = sqlite3_close(threads[i].db_);
+    error_check(status);
+    threads[i].db_ = NULL;
+  }
 
-  sqlite3_stmt *replace_stmt, *begin_trans_stmt, *end_trans_stmt;
-  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
-  char* begin_trans_str = "BEGIN TRANSACTION";
-  char* end_trans_str = "END TRANSACTION";
+  free(tids);
+  free(arg);
+  pthread_cond_destroy(&shared.cv_);
+  pthread_mutex_destroy(&shared.mu_);
+  return threads;
+}
 
-  /* Check for synchronous flag in options */
-  char* sync_stmt = (write_sync) ? "PRAGMA synchronous = FULL" :
-                                    "PRAGMA synchronous = OFF";
-  status = sqlite3_exec(db_, sync_stmt, NULL, NULL, &err_msg);
-  exec_error_check(status, err_msg);
+/* Merge the stats of threads[from..to) into merged */
+static void merge_threads(ThreadState* threads, int from, int to,
+                          Stats* merged) {
+  stats_init(merged);
+  for (int i = from; i < to; i++) {
+    stats_merge(merged, &threads[i].stats_);
+  }
+}
 
-  /* Preparing sqlite3 statements */
-  status = sqlite3_prepare_v2(db_, replace_str, -1,
-                              &replace_stmt, NULL);
-  error_check(status);
-  status = sqlite3_prepare_v2(db_, begin_trans_str, -1,
-                              &begin_trans_stmt, NULL);
-  error_check(status);
-  status = sqlite3_prepare_v2(db_, end_trans_str, -1,
-                              &end_trans_stmt, NULL);
-  error_check(status);
+static void free_threads(ThreadState* threads, int n) {
+  for (int i = 0; i < n; i++) {
+    stats_free(&threads[i].stats_);
+    raw_log_free(&threads[i].raw_log_);
+  }
+  free(threads);
+}
 
-  bool transaction = (entries_per_batch > 1);
+/*
+ * Run a read benchmark on 1..FLAGS_threads threads and report aggregate
+ * and per-thread throughput together with the scaling efficiency
+ * relative to a single thread.
+ */
+static void run_scaling(const char* name, void (*method)(ThreadState*)) {
+  double* aggregate = calloc(FLAGS_threads + 1, sizeof(double));
+  Stats merged;
+
+  share_database(db_, true);
+  for (int n = 1; n <= FLAGS_threads; n++) {
+    ThreadState* threads = run_threads(n, method);
+    merge_threads(threads, 0, n, &merged);
+    aggregate[n] = merged.done_ / stats_elapsed(&merged);
+
+    message_ = malloc(sizeof(char) * 100);
+    snprintf(message_, 100, "(%d threads) %.0f ops/s", n, aggregate[n]);
+    stats_report(&merged, name);
+    for (int i = 0; i < n; i++) {
+      Stats* stats = &threads[i].stats_;
+      fprintf(stderr, "  thread %-4d : %11.0f ops/s\n", i,
+              stats->done_ / stats_elapsed(stats));
+    }
+    stats_free(&merged);
+    free_threads(threads, n);
+  }
+  share_database(db_, false);
+
+  fprintf(stderr, "%-12s : %7s %14s %14s %10s\n",
+          name, "threads", "ops/s", "ops/s/thread", "efficiency");
+  for (int n = 1; n <= FLAGS_threads; n++) {
+    fprintf(stderr, "%-12s   %7d %14.0f %14.0f %9.1f%%\n",
+            "", n, aggregate[n], aggregate[n] / n,
+            100.0 * aggregate[n] / (n * aggregate[1]));
+  }
+  fflush(stderr);
+
+  free(aggregate);
+}
+
+/* Run method once on n threads and report the merged stats */
+static void run_concurrent(const char* name, int n,
+                           void (*method)(ThreadState*)) {
+  Stats merged;
+
+  share_database(db_, true);
+  ThreadState* threads = run_threads(n, method);
+  share_database(db_, false);
+
+  merge_threads(threads, 0, n, &merged);
+  message_ = malloc(sizeof(char) * 100);
+  snprintf(message_, 100, "(%d threads) %.0f ops/s", n,
+           merged.done_ / stats_elapsed(&merged));
+  stats_report(&merged, name);
+  stats_free(&merged);
+  free_threads(threads, n);
+}
+
+/*
+ * Thread 0 keeps writing random keys until the FLAGS_threads reader
+ * threads are done; readers and the writer are reported separately.
+ */
+static void run_read_while_writing(const char* name) {
+  int n = FLAGS_threads + 1;
+  Stats readers;
+
+  share_database(db_, true);
+  ThreadState* threads = run_threads(n, read_while_writing);
+  share_database(db_, false);
+
+  merge_threads(threads, 1, n, &readers);
+  message_ = malloc(sizeof(char) * 200);
+  snprintf(message_, 200,
+           "(%d readers) %.0f reads/s; p50 %.3f p99 %.3f p99.9 %.3f micros",
+           FLAGS_threads,
+           readers.done_ / stats_elapsed(&readers),
+           histogram_percentile(&readers.hist_, 50.0) * 1e-3,
+           histogram_percentile(&readers.hist_, 99.0) * 1e-3,
+           histogram_percentile(&readers.hist_, 99.9) * 1e-3);
+  stats_report(&readers, name);
+  stats_free(&readers);
+
+  Stats* writer = &threads[0].stats_;
+  message_ = malloc(sizeof(char) * 100);
+  snprintf(message_, 100, "(writer) %.0f writes/s",
+           writer->done_ / stats_elapsed(writer));
+  stats_report(writer, name);
+
+  free_threads(threads, n);
+}
+
+static void read_sequential(ThreadState* thread) {
+  benchmark_read_sequential(thread, false);
+}
+
+static void read_reverse(ThreadState* thread) {
+  benchmark_read_sequential(thread, true);
+}
+
+static void read_random(ThreadState* thread) {
+  benchmark_read(thread, RANDOM, 1);
+}
+
+static void seek_random(ThreadState* thread) {
+  benchmark_seek(thread, 1);
+}
+
+static void scan_random(ThreadState* thread) {
+  benchmark_seek(thread, FLAGS_scan_length);
+}
+
+void benchmark_init() {
+  db_ = NULL;
+  db_num_ = 0;
+  num_ = FLAGS_num;
+  reads_ = FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads;
+  poisson_arrival_ = !strcmp(FLAGS_arrival, "poisson");
+  key_dist_ = key_dist_from_string(FLAGS_key_dist);
+  if (FLAGS_workload != NULL) workload_load(&workload_, FLAGS_workload);
+  if (FLAGS_replay != NULL) trace_load(&trace_, FLAGS_replay);
+  if (FLAGS_trace_out != NULL) {
+    trace_out_ = fopen(FLAGS_trace_out, "w");
+    if (!trace_out_) {
+      fprintf(stderr, "cannot open %s\n", FLAGS_trace_out);
+      exit(1);
+    }
+  }
+  threading_init(FLAGS_threading);
+  sqlite_malloc_init(FLAGS_sqlite_malloc, FLAGS_heap_size);
+  if (FLAGS_alloc_stats) alloc_stats_init();
+  /* Before any VFS is registered, since that initializes SQLite */
+  if (strcmp(FLAGS_pcache, "default")) pcache_init(FLAGS_pcache);
+  if (FLAGS_mutex_stats) mutex_stats_init();
+  if (!strcmp(FLAGS_storage, "memory")) vfs_memory_init();
+  if (FLAGS_io_uring && !vfs_io_uring_init(FLAGS_io_uring_registered)) {
+    fprintf(stderr, "io_uring is not available\n");
+    exit(1);
+  }
+  if (FLAGS_direct_io && !vfs_direct_init()) {
+    fprintf(stderr, "direct I/O is not available\n");
+    exit(1);
+  }
+  if (strcmp(FLAGS_madvise, "none")) vfs_madvise_init(FLAGS_madvise);
+  /* Installed before the stats VFS, which then sees the injected latency */
+  if (vfs_delay_enabled()) vfs_delay_init();
+  if (FLAGS_vfs_stats) vfs_stats_init();
+  if (FLAGS_report != NULL) report_begin(FLAGS_report);
+  if (FLAGS_raw_file != NULL) raw_log_open(FLAGS_raw_file);
+  stats_file_ = stdout;
+  if (FLAGS_stats_file) {
+    stats_file_ = fopen(FLAGS_stats_file, "w");
+    if (!stats_file_) {
+      fprintf(stderr, "cannot open %s\n", FLAGS_stats_file);
+      exit(1);
+    }
+  }
+  if (FLAGS_stats_interval > 0 && !strcmp(FLAGS_stats_format, "csv")) {
+    fprintf(stats_file_, "benchmark,thread,time,ops,ops_per_sec,"
+            "mb_per_sec,p50_micros,p99_micros\n");
+  }
+  if (!clock_init(FLAGS_clock)) {
+    fprintf(stderr, "clock source '%s' is not available\n", FLAGS_clock);
+    exit(1);
+  }
+  rand_gen_init(&gen_, FLAGS_compression_ratio);
+  thread_init(&thread_, 0, NULL);
+  rand_init(&thread_.rand_, 301);
+
+  if (!strcmp(FLAGS_storage, "memory")) return;
+
+  struct dirent* ep;
+  DIR* test_dir = opendir(FLAGS_db);
+  if (!FLAGS_use_existing_db) {
+    while ((ep = readdir(test_dir)) != NULL) {
+      if (starts_with(ep->d_name, "dbbench_sqlite3")) {
+        char file_name[1000];
+        strcpy(file_name, FLAGS_db);
+        strcat(file_name, ep->d_name);
+        remove(file_name);
+      }
+    }
+  }
+  closedir(test_dir);
+}
+
+void benchmark_fini() {
+  int status = sqlite3_close(db_);
+  error_check(status);
+  if (trace_out_ != NULL) fclose(trace_out_);
+  if (stats_file_ != stdout) fclose(stats_file_);
+  raw_log_free(&thread_.raw_log_);
+  raw_log_close();
+  report_end();
+  if (vfs_delay_enabled()) vfs_delay_fini();
+  if (FLAGS_io_uring) vfs_io_uring_fini();
+  workload_free(&workload_);
+  trace_free(&trace_);
+}
+
+/*
+ * Merge the histograms that --histogram_out wrote to each of the
+ * comma-separated files, by benchmark name, and report each result.
+ */
+void benchmark_merge_histograms(const char* paths) {
+  const int kMaxNames = 64;
+  char names[kMaxNames][64];
+  Histogram merged[kMaxNames];
+  int num_names = 0;
+  char name[64];
+  Histogram hist;
+
+  memset(merged, 0, sizeof(merged));
+  memset(&hist, 0, sizeof(hist));
+  while (paths != NULL && *paths != '\0') {
+    const char* sep = strchr(paths, ',');
+    size_t len = sep ? (size_t)(sep - paths) : strlen(paths);
+    char path[1024];
+    snprintf(path, sizeof(path), "%.*s", (int)len, paths);
+    paths = sep ? sep + 1 : NULL;
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+      fprintf(stderr, "cannot open %s\n", path);
+      exit(1);
+    }
+    histogram_clear(&hist);
+    while (histogram_read(f, name, sizeof(name), &hist)) {
+      int i = 0;
+      while (i < num_names && strcmp(names[i], name)) i++;
+      if (i == num_names) {
+        if (num_names == kMaxNames) {
+          fprintf(stderr, "too many histograms in %s\n", path);
+          exit(1);
+        }
+        strcpy(names[num_names], name);
+        histogram_clear(&merged[num_names]);
+        num_names++;
+      }
+      histogram_merge(&merged[i], &hist);
+      histogram_clear(&hist);
+    }
+    if (!feof(f)) {
+      fprintf(stderr, "malformed histogram in %s\n", path);
+      exit(1);
+    }
+    fclose(f);
+  }
+
+  for (int i = 0; i < num_names; i++) {
+    fprintf(stderr, "%-12s : %11.3f micros/op; %.0f ops\n", names[i],
+            merged[i].num_ > 0 ? merged[i].sum_ / merged[i].num_ * 1e-3 : 0,
+            merged[i].num_);
+    fprintf(stderr, "Nanoseconds per op:\n%s\n",
+            histogram_to_string(&merged[i]));
+    histogram_free(&merged[i]);
+  }
+  histogram_free(&hist);
+}
+
+/* Write the --raw_file log at path as CSV to stdout */
+bool benchmark_decode_raw(const char* path) {
+  return raw_log_decode(path, stdout, op_type_names);
+}
+
+/*
+ * Run the phases of the --workload file in order, each reported like a
+ * benchmark named after the phase.
+ */
+static void run_workload() {
+  workload_records_ = num_;
+  for (int i = 0; i < workload_.num_phases_; i++) {
+    phase_ = &workload_.phases_[i];
+    const char* name = phase_->name_;
+    benchmark_name_ = name;
+    if (raw_log_enabled()) raw_log_benchmark(name);
+    start(&thread_);
+    if (phase_->fresh_) {
+      if (FLAGS_use_existing_db) {
+        message_ = malloc(sizeof(char) * 100);
+        strcpy(message_, "skipping (--use_existing_db is true)");
+        stop(&thread_, name);
+        continue;
+      }
+      sqlite3_close(db_);
+      db_ = NULL;
+      benchmark_open();
+      thread_.db_ = db_;
+      workload_records_ = num_;
+      start(&thread_);
+    }
+    phase_keys_ = phase_->key_space_ > 0 ? phase_->key_space_ :
+                                           workload_records_;
+    phase_next_key_ = 0;
+    if (phase_->threads_ > 1) {
+      run_concurrent(name, phase_->threads_, run_phase);
+    } else {
+      run_phase(&thread_);
+      stop(&thread_, name);
+    }
+  }
+}
+
+/* Order of fingerprints by the time their statements took, longest first */
+static int compare_total_time(const void* a, const void* b) {
+  double x = replay_merged_[*(const int*)a].sum_;
+  double y = replay_merged_[*(const int*)b].sum_;
+  return (x < y) - (x > y);
+}
+
+/* Latency of each statement fingerprint of the --replay trace */
+static void print_statements() {
+  int n = trace_.num_fingerprints_;
+  int* order = malloc(n * sizeof(int));
+  for (int i = 0; i < n; i++) order[i] = i;
+  qsort(order, n, sizeof(int), compare_total_time);
+
+  double total = 0;
+  for (int i = 0; i < n; i++) total += replay_merged_[i].sum_;
+  for (int i = 0; i < n; i++) {
+    Histogram* hist = &replay_merged_[order[i]];
+    if (hist->num_ == 0) continue;
+    char label[32];
+    snprintf(label, sizeof(label), "statement %d", i + 1);
+    fprintf(stderr, "  %-15s : %11.0f ops; %9.3f micros/op; p50 %.3f "
+            "p99 %.3f p99.9 %.3f; %.1f%% of time", label, hist->num_,
+            hist->sum_ / hist->num_ * 1e-3,
+            histogram_percentile(hist, 50.0) * 1e-3,
+            histogram_percentile(hist, 99.0) * 1e-3,
+            histogram_percentile(hist, 99.9) * 1e-3,
+            total > 0 ? 100.0 * hist->sum_ / total : 0.0);
+    if (replay_merged_errors_[order[i]] > 0) {
+      fprintf(stderr, "; %" PRId64 " errors", replay_merged_errors_[order[i]]);
+    }
+    fprintf(stderr, "\n  %-15s   %.100s\n", "",
+            trace_.fingerprints_[order[i]]);
+  }
+  free(order);
+}
+
+/*
+ * Replay the --replay trace, each traced connection on a thread and
+ * connection of its own, and report latency by statement fingerprint.
+ */
+static void run_replay() {
+  const char* name = "replay";
+  int n = trace_.num_streams_;
+  int fingerprints = trace_.num_fingerprints_;
+  Stats merged;
+
+  benchmark_name_ = name;
+  if (raw_log_enabled()) raw_log_benchmark(name);
+  start(&thread_);
+  replay_hists_ = calloc((size_t)n * fingerprints, sizeof(Histogram));
+  replay_errors_ = calloc((size_t)n * fingerprints, sizeof(int64_t));
+  replay_lag_ = calloc(n, sizeof(uint64_t));
+  replay_closed_ = calloc(n, sizeof(bool));
+  for (int i = 0; i < n * fingerprints; i++) {
+    histogram_clear(&replay_hists_[i]);
+  }
+  replay_start_ = 0;
+
+  if (db_ != NULL) share_database(db_, true);
+  ThreadState* threads = run_threads(n, replay_connection);
+  if (db_ != NULL) share_database(db_, false);
+
+  uint64_t lag = 0;
+  replay_merged_ = calloc(fingerprints, sizeof(Histogram));
+  replay_merged_errors_ = calloc(fingerprints, sizeof(int64_t));
+  for (int i = 0; i < fingerprints; i++) {
+    histogram_clear(&replay_merged_[i]);
+    for (int t = 0; t < n; t++) {
+      histogram_merge(&replay_merged_[i],
+                      &replay_hists_[t * fingerprints + i]);
+      replay_merged_errors_[i] += replay_errors_[t * fingerprints + i];
+    }
+  }
+  for (int t = 0; t < n; t++) {
+    if (replay_lag_[t] > lag) lag = replay_lag_[t];
+  }
+
+  merge_threads(threads, 0, n, &merged);
+  message_ = malloc(sizeof(char) * 100);
+  int len = snprintf(message_, 100, "(%d connections) %.0f statements/s", n,
+                     merged.done_ / stats_elapsed(&merged));
+  if (FLAGS_replay_speed > 0) {
+    snprintf(message_ + len, 100 - len, ", up to %.3f ms behind",
+             lag * 1e-6);
+  }
+  stats_report(&merged, name);
+  print_statements();
+  stats_free(&merged);
+  free_threads(threads, n);
+
+  for (int i = 0; i < n * fingerprints; i++) {
+    histogram_free(&replay_hists_[i]);
+  }
+  for (int i = 0; i < fingerprints; i++) histogram_free(&replay_merged_[i]);
+  free(replay_hists_);
+  free(replay_errors_);
+  free(replay_lag_);
+  free(replay_closed_);
+  free(replay_merged_);
+  free(replay_merged_errors_);
+  replay_merged_ = NULL;
+  replay_merged_errors_ = NULL;
+}
+
+void benchmark_run() {
+  print_header();
+  if (report_enabled()) {
+    report_flags();
+    report_begin_array("benchmarks");
+  }
+  if (FLAGS_replay != NULL) {
+    /* A trace of the benchmarks' own statements replays against the
+     * usual database; other traces bring their own with --replay_db */
+    if (FLAGS_replay_db == NULL) benchmark_open();
+    thread_.db_ = db_;
+    run_replay();
+    return;
+  }
+  benchmark_open();
+  thread_.db_ = db_;
+
+  if (workload_.num_phases_ > 0) {
+    run_workload();
+    return;
+  }
+
+  char* benchmarks = FLAGS_benchmarks;
+  while (benchmarks != NULL) {
+    char* sep = strchr(benchmarks, ',');
+    char* name;
+    if (sep == NULL) {
+      name = benchmarks;
+      benchmarks = NULL;
+    } else {
+      name = calloc(sizeof(char), (sep - benchmarks + 1));
+      strncpy(name, benchmarks, sep - benchmarks);
+      benchmarks = sep + 1;
+    }
+    benchmark_name_ = name;
+    if (raw_log_enabled()) raw_log_benchmark(name);
+    start(&thread_);
+    bool known = true;
+    bool write_sync = false;
+    void (*method)(ThreadState*) = NULL;
+    bool scaling = false;
+    int saved_reads = reads_;
+    if (!strcmp(name, "fillseq")) {
+      benchmark_write(&thread_, write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "fillseqbatch")) {
+      benchmark_write(&thread_, write_sync, SEQUENTIAL, FRESH, num_, FLAGS_value_size, 1000);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "fillrandom")) {
+      benchmark_write(&thread_, write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "fillrandbatch")) {
+      benchmark_write(&thread_, write_sync, RANDOM, FRESH, num_, FLAGS_value_size, 1000);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "overwrite")) {
+      benchmark_write(&thread_, write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "overwritebatch")) {
+      benchmark_write(&thread_, write_sync, RANDOM, EXISTING, num_, FLAGS_value_size, 1000);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "fillrandsync")) {
+      write_sync = true;
+      benchmark_write(&thread_, write_sync, RANDOM, FRESH, num_ / 100, FLAGS_value_size, 1);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "fillseqsync")) {
+      write_sync = true;
+      benchmark_write(&thread_, write_sync, SEQUENTIAL, FRESH, num_ / 100, FLAGS_value_size, 1);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "fillrand100K")) {
+      benchmark_write(&thread_, write_sync, RANDOM, FRESH, num_ / 1000, 100 * 1000, 1);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "fillseq100K")) {
+      benchmark_write(&thread_, write_sync, SEQUENTIAL, FRESH, num_ / 1000, 100 * 1000, 1);
+      wal_checkpoint(db_);
+    } else if (!strcmp(name, "readseq")) {
+      method = read_sequential;
+      scaling = true;
+    } else if (!strcmp(name, "readreverse")) {
+      method = read_reverse;
+      scaling = true;
+    } else if (!strcmp(name, "readrandom")) {
+      method = read_random;
+      scaling = true;
+    } else if (!strcmp(name, "seekrandom")) {
+      method = seek_random;
+      scaling = true;
+    } else if (!strcmp(name, "scanrandom")) {
+      method = scan_random;
+      scaling = true;
+    } else if (!strcmp(name, "readrand100K")) {
+      reads_ /= 1000;
+      method = read_random;
+      scaling = true;
+    } else if (!strcmp(name, "readwhilewriting")) {
+      run_read_while_writing(name);
+      known = false;
+    } else if (starts_with(name, "ycsb_")) {
+      for (ycsb_ = ycsb_workloads; ycsb_->name_ != NULL; ycsb_++) {
+        if (!strcmp(name, ycsb_->name_)) break;
+      }
+      if (ycsb_->name_ != NULL) {
+        /* The load left num_ records; later YCSB runs on the same database
+         * keep the count, which includes what D and E inserted */
+        if (ycsb_records_ == 0) ycsb_records_ = num_;
+        method = run_ycsb;
+      } else {
+        known = false;
+        fprintf(stderr, "unknown benchmark '%s'\n", name);
+      }
+    } else {
+      known = false;
+      if (strcmp(name, "")) {
+        fprintf(stderr, "unknown benchmark '%s'\n", name);
+      }
+    }
+    if (method != NULL && FLAGS_threads > 1 && scaling) {
+      run_scaling(name, method);
+      known = false;
+    } else if (method != NULL && FLAGS_threads > 1) {
+      run_concurrent(name, FLAGS_threads, method);
+      known = false;
+    } else if (method != NULL) {
+      method(&thread_);
+    }
+    reads_ = saved_reads;
+    if (known) {
+      stop(&thread_, name);
+    }
+  }
+}
+
+void benchmark_open() {
+  assert(db_ == NULL);
+
+  int status;
+  char* err_msg = NULL;
+  db_num_++;
+  /* A new database has no YCSB records until the next YCSB run counts
+   * the load */
+  ycsb_records_ = 0;
+
+  /* Release the databases of earlier benchmarks */
+  if (!strcmp(FLAGS_storage, "memory")) vfs_memory_clear();
+
+  /* Open database */
+  db_ = open_connection();
+
+  /* Change locking mode to exclusive and create tables/index for database */
+  char* locking_stmt = "PRAGMA locking_mode = EXCLUSIVE";
+  char* create_stmt =
+          "CREATE TABLE test (key blob, value blob, PRIMARY KEY (key))";
+  char* stmt_array[] = { locking_stmt, create_stmt, NULL };
+  int stmt_array_length = sizeof(stmt_array) / sizeof(char*);
+  for (int i = 0; i < stmt_array_length; i++) {
+    status = sqlite3_exec(db_, stmt_array[i], NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+
+  /* Trace what the benchmarks run, not how the database was set up */
+  trace_connection(db_);
+}
+
+/* Key generator over [0, items) following --key_dist */
+static void key_gen_setup(KeyGenerator* keys, int items) {
+  key_gen_init(keys, key_dist_, items, FLAGS_zipf_theta,
+               FLAGS_hotspot_ops_fraction, FLAGS_hotspot_keys_fraction);
+}
+
+/* REPLACE one key-value pair with a freshly generated value */
+static void write_entry(ThreadState* thread, sqlite3_stmt* replace_stmt,
+                        int k, int value_size) {
+  int status;
+  const char* value = rand_gen_generate(&thread->gen_, value_size);
+  thread->key_ = k;
+
+  /* Create values for key-value pair */
+  char key[kKeySize];
+  encode_key(key, k);
+
+  /* Bind KV values into replace_stmt */
+  status = sqlite3_bind_blob(replace_stmt, 1, key, kKeySize, SQLITE_STATIC);
+  error_check(status);
+  status = sqlite3_bind_blob(replace_stmt, 2, value,
+                              value_size, SQLITE_STATIC);
+  error_check(status);
+
+  /* Execute replace_stmt */
+  thread->stats_.bytes_ += value_size + kKeySize;
+  status = step_rows(replace_stmt);
+  step_error_check(status);
+
+  /* Reset SQLite statement for another use */
+  status = sqlite3_clear_bindings(replace_stmt);
+  error_check(status);
+  status = sqlite3_reset(replace_stmt);
+  error_check(status);
+}
+
+/* Look up one key */
+static void read_entry(ThreadState* thread, sqlite3_stmt* read_stmt, int k) {
+  int status;
+  thread->key_ = k;
+
+  /* Create key value */
+  char key[kKeySize];
+  encode_key(key, k);
+
+  /* Bind key value into read_stmt */
+  status = sqlite3_bind_blob(read_stmt, 1, key, kKeySize, SQLITE_STATIC);
+  error_check(status);
+
+  /* Execute read statement */
+  status = step_rows(read_stmt);
+  step_error_check(status);
+
+  /* Reset SQLite statement for another use */
+  status = sqlite3_clear_bindings(read_stmt);
+  error_check(status);
+  status = sqlite3_reset(read_stmt);
+  error_check(status);
+}
+
+/* Delete one key */
+static void delete_entry(ThreadState* thread, sqlite3_stmt* delete_stmt,
+                         int k) {
+  int status;
+  thread->key_ = k;
+
+  /* Create key value */
+  char key[kKeySize];
+  encode_key(key, k);
+
+  /* Bind key value into delete_stmt */
+  status = sqlite3_bind_blob(delete_stmt, 1, key, kKeySize, SQLITE_STATIC);
+  error_check(status);
+
+  /* Execute delete statement */
+  status = sqlite3_step(delete_stmt);
+  step_error_check(status);
+
+  /* Reset SQLite statement for another use */
+  status = sqlite3_clear_bindings(delete_stmt);
+  error_check(status);
+  status = sqlite3_reset(delete_stmt);
+  error_check(status);
+}
+
+/* Read up to n rows in key order starting at key k */
+static void scan_entries(ThreadState* thread, sqlite3_stmt* scan_stmt, int k,
+                         int n) {
+  int status;
+  thread->key_ = k;
+
+  /* Create key value */
+  char key[kKeySize];
+  encode_key(key, k);
+
+  /* Bind start key and row limit into scan_stmt */
+  status = sqlite3_bind_blob(scan_stmt, 1, key, kKeySize, SQLITE_STATIC);
+  error_check(status);
+  status = sqlite3_bind_int(scan_stmt, 2, n);
+  error_check(status);
+
+  /* Step through the rows */
+  while ((status = sqlite3_step(scan_stmt)) == SQLITE_ROW) {
+    thread->stats_.bytes_ += sqlite3_column_bytes(scan_stmt, 0) +
+                             sqlite3_column_bytes(scan_stmt, 1);
+    thread->stats_.rows_++;
+  }
+  step_error_check(status);
+
+  /* Reset SQLite statement for another use */
+  status = sqlite3_clear_bindings(scan_stmt);
+  error_check(status);
+  status = sqlite3_reset(scan_stmt);
+  error_check(status);
+}
+
+void benchmark_write(ThreadState* thread, bool write_sync, int order,
+                  int state, int num_entries, int value_size,
+                  int entries_per_batch) {
+  /* Create new database if state == FRESH */
+  if (state == FRESH) {
+    if (FLAGS_use_existing_db) {
+      message_ = malloc(sizeof(char) * 100);
+      strcpy(message_, "skipping (--use_existing_db is true)");
+      return;
+    }
+    sqlite3_close(db_);
+    db_ = NULL;
+    benchmark_open();
+    thread->db_ = db_;
+    start(thread);
+  }
+
+  if (num_entries != num_) {
+    char* msg = malloc(sizeof(char) * 100);
+    snprintf(msg, 100, "(%d ops)", num_entries);
+    message_ = msg;
+  }
+
+  char* err_msg = NULL;
+  int status;
+
+  sqlite3_stmt *replace_stmt, *begin_trans_stmt, *end_trans_stmt;
+  KeyGenerator keys;
+  key_gen_setup(&keys, num_entries);
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+  char* begin_trans_str = "BEGIN TRANSACTION";
+  char* end_trans_str = "END TRANSACTION";
+
+  /* Check for synchronous flag in options */
+  char* sync_stmt = (write_sync) ? "PRAGMA synchronous = FULL" :
+                                    "PRAGMA synchronous = OFF";
+  status = sqlite3_exec(thread->db_, sync_stmt, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+
+  /* Preparing sqlite3 statements */
+  status = sqlite3_prepare_v2(thread->db_, replace_str, -1,
+                              &replace_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, begin_trans_str, -1,
+                              &begin_trans_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, end_trans_str, -1,
+                              &end_trans_stmt, NULL);
+  error_check(status);
+
+  bool transaction = (entries_per_batch > 1);
   for (int i = 0; i < num_entries; i += entries_per_batch) {
     /* Begin write transaction */
     if (FLAGS_transaction && transaction) {
@@ -435,33 +1881,11 @@ void benchmark_write(bool write_sync, int order, int state,
 
     /* Create and execute SQL statements */
     for (int j = 0; j < entries_per_batch; j++) {
-      const char* value = rand_gen_generate(&gen_, value_size);
-
-      /* Create values for key-value pair */
       const int k = (order == SEQUENTIAL) ? i + j :
-                    (rand_next(&rand_) % num_entries);
-      char key[100];
-      snprintf(key, sizeof(key), "%016d", k);
-
-      /* Bind KV values into replace_stmt */
-      status = sqlite3_bind_blob(replace_stmt, 1, key, 16, SQLITE_STATIC);
-      error_check(status);
-      status = sqlite3_bind_blob(replace_stmt, 2, value,
-                                  value_size, SQLITE_STATIC);
-      error_check(status);
-
-      /* Execute replace_stmt */
-      bytes_ += value_size + strlen(key);
-      status = sqlite3_step(replace_stmt);
-      step_error_check(status);
-
-      /* Reset SQLite statement for another use */
-      status = sqlite3_clear_bindings(replace_stmt);
-      error_check(status);
-      status = sqlite3_reset(replace_stmt);
-      error_check(status);
-
-      finished_single_op();
+                    key_gen_next(&keys, &thread->rand_);
+      start_single_op(thread);
+      write_entry(thread, replace_stmt, k, value_size);
+      finished_single_op(thread, OP_WRITE);
     }
 
     /* End write transaction */
@@ -481,22 +1905,24 @@ void benchmark_write(bool write_sync, int order, int state,
   error_check(status);
 }
 
-void benchmark_read(int order, int entries_per_batch) {
+void benchmark_read(ThreadState* thread, int order, int entries_per_batch) {
   int status;
   sqlite3_stmt *read_stmt, *begin_trans_stmt, *end_trans_stmt;
+  KeyGenerator keys;
+  key_gen_setup(&keys, reads_);
 
   char *read_str = "SELECT * FROM test WHERE key = ?";
   char *begin_trans_str = "BEGIN TRANSACTION";
   char *end_trans_str = "END TRANSACTION";
 
   /* Preparing sqlite3 statements */
-  status = sqlite3_prepare_v2(db_, begin_trans_str, -1,
+  status = sqlite3_prepare_v2(thread->db_, begin_trans_str, -1,
                               &begin_trans_stmt, NULL);
   error_check(status);
-  status = sqlite3_prepare_v2(db_, end_trans_str, -1,
+  status = sqlite3_prepare_v2(thread->db_, end_trans_str, -1,
                               &end_trans_stmt, NULL);
   error_check(status);
-  status = sqlite3_prepare_v2(db_, read_str, -1,
+  status = sqlite3_prepare_v2(thread->db_, read_str, -1,
                               &read_stmt, NULL);
   error_check(status);
 
@@ -512,25 +1938,11 @@ void benchmark_read(int order, int entries_per_batch) {
 
     /* Create and execute SQL statements */
     for (int j = 0; j < entries_per_batch; j++) {
-      /* Create key value */
-      char key[100];
-      int k = (order == SEQUENTIAL) ? i + j : (rand_next(&rand_) % reads_);
-      snprintf(key, sizeof(key), "%016d", k);
-
-      /* Bind key value into read_stmt */
-      status = sqlite3_bind_blob(read_stmt, 1, key, 16, SQLITE_STATIC);
-      error_check(status);
-      
-      /* Execute read statement */
-      while ((status = sqlite3_step(read_stmt)) == SQLITE_ROW) {}
-      step_error_check(status);
-
-      /* Reset SQLite statement for another use */
-      status = sqlite3_clear_bindings(read_stmt);
-      error_check(status);
-      status = sqlite3_reset(read_stmt);
-      error_check(status);
-      finished_single_op();
+      int k = (order == SEQUENTIAL) ? i + j :
+              key_gen_next(&keys, &thread->rand_);
+      start_single_op(thread);
+      read_entry(thread, read_stmt, k);
+      finished_single_op(thread, OP_READ);
     }
 
     /* End read transaction */
@@ -549,3 +1961,456 @@ void benchmark_read(int order, int entries_per_batch) {
   status = sqlite3_finalize(end_trans_stmt);
   error_check(status);
 }
+
+static void read_while_writing(ThreadState* thread) {
+  if (thread->tid_ > 0) {
+    thread->measure_latency_ = true;
+    /* Each reader schedules its own arrivals at its share of the rate */
+    if (FLAGS_target_rate > 0) {
+      thread->arrival_interval_ = FLAGS_threads * 1e9 / FLAGS_target_rate;
+    }
+    benchmark_read(thread, RANDOM, 1);
+    return;
+  }
+
+  /* Special thread that keeps writing until other threads are done */
+  thread->arrival_interval_ = 0;
+  SharedState* shared = thread->shared_;
+  char* err_msg = NULL;
+  int status;
+  sqlite3_stmt *replace_stmt;
+  KeyGenerator keys;
+  key_gen_setup(&keys, num_);
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+
+  status = sqlite3_exec(thread->db_, "PRAGMA synchronous = OFF", NULL, NULL,
+                        &err_msg);
+  exec_error_check(status, err_msg);
+  status = sqlite3_prepare_v2(thread->db_, replace_str, -1,
+                              &replace_stmt, NULL);
+  error_check(status);
+
+  while (true) {
+    pthread_mutex_lock(&shared->mu_);
+    bool readers_done = (shared->num_done_ + 1 >= shared->num_initialized_);
+    pthread_mutex_unlock(&shared->mu_);
+    if (readers_done) {
+      /* Other threads have finished */
+      break;
+    }
+
+    const int k = key_gen_next(&keys, &thread->rand_);
+    write_entry(thread, replace_stmt, k, FLAGS_value_size);
+    finished_single_op(thread, OP_WRITE);
+  }
+
+  status = sqlite3_finalize(replace_stmt);
+  error_check(status);
+}
+
+/*
+ * Walk one cursor over the table in key order, or in reverse key order,
+ * stepping through up to reads_ rows.  Each row counts as one op.
+ */
+void benchmark_read_sequential(ThreadState* thread, bool reverse) {
+  int status;
+  sqlite3_stmt *scan_stmt;
+  char *scan_str = reverse ?
+          "SELECT key, value FROM test ORDER BY key DESC" :
+          "SELECT key, value FROM test ORDER BY key";
+
+  status = sqlite3_prepare_v2(thread->db_, scan_str, -1, &scan_stmt, NULL);
+  error_check(status);
+
+  int i = 0;
+  start_single_op(thread);
+  while (i < reads_ && (status = sqlite3_step(scan_stmt)) == SQLITE_ROW) {
+    thread->stats_.bytes_ += sqlite3_column_bytes(scan_stmt, 0) +
+                             sqlite3_column_bytes(scan_stmt, 1);
+    thread->stats_.rows_++;
+    finished_single_op(thread, OP_READ);
+    if (++i < reads_) {
+      start_single_op(thread);
+    }
+  }
+  if (i < reads_) {
+    step_error_check(status);
+  }
+
+  status = sqlite3_finalize(scan_stmt);
+  error_check(status);
+}
+
+/*
+ * Seek to reads_ random keys and read the next scan_length rows from each
+ * in key order.  Each seek counts as one op.
+ */
+void benchmark_seek(ThreadState* thread, int scan_length) {
+  int status;
+  sqlite3_stmt *scan_stmt;
+  char *scan_str =
+          "SELECT key, value FROM test WHERE key >= ? ORDER BY key LIMIT ?";
+  KeyGenerator keys;
+  key_gen_setup(&keys, num_);
+
+  status = sqlite3_prepare_v2(thread->db_, scan_str, -1, &scan_stmt, NULL);
+  error_check(status);
+
+  thread->stats_.op_unit_ = "seeks";
+  for (int i = 0; i < reads_; i++) {
+    int k = key_gen_next(&keys, &thread->rand_);
+    start_single_op(thread);
+    scan_entries(thread, scan_stmt, k, scan_length);
+    finished_single_op(thread, OP_SCAN);
+  }
+
+  status = sqlite3_finalize(scan_stmt);
+  error_check(status);
+}
+
+/*
+ * YCSB core workloads A-F on the test table loaded with FLAGS_num keys.
+ * Each thread does reads_ operations drawn from the workload's mix;
+ * inserts append keys past the loaded ones.
+ */
+static void run_ycsb(ThreadState* thread) {
+  const YcsbWorkload* w = ycsb_;
+  char* err_msg = NULL;
+  int status;
+  sqlite3_stmt *read_stmt, *replace_stmt, *scan_stmt;
+  char* read_str = "SELECT * FROM test WHERE key = ?";
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+  char* scan_str =
+          "SELECT key, value FROM test WHERE key >= ? ORDER BY key LIMIT ?";
+  KeyGenerator keys;
+  key_gen_init(&keys, w->key_dist_, ycsb_records_, FLAGS_zipf_theta,
+               FLAGS_hotspot_ops_fraction, FLAGS_hotspot_keys_fraction);
+
+  status = sqlite3_exec(thread->db_, "PRAGMA synchronous = OFF", NULL, NULL,
+                        &err_msg);
+  exec_error_check(status, err_msg);
+
+  /* Preparing sqlite3 statements */
+  status = sqlite3_prepare_v2(thread->db_, read_str, -1, &read_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, replace_str, -1, &replace_stmt,
+                              NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, scan_str, -1, &scan_stmt, NULL);
+  error_check(status);
+
+  thread->measure_latency_ = true;
+  for (int i = 0; i < reads_; i++) {
+    if (w->insert_ > 0) {
+      /* Pick up keys inserted by other threads */
+      key_gen_resize(&keys, __atomic_load_n(&ycsb_records_, __ATOMIC_RELAXED));
+    }
+
+    double p = rand_double(&thread->rand_);
+    int op_type;
+    start_single_op(thread);
+    if (p < w->update_) {
+      op_type = OP_UPDATE;
+      write_entry(thread, replace_stmt, key_gen_next(&keys, &thread->rand_),
+                  FLAGS_value_size);
+    } else if (p < w->update_ + w->insert_) {
+      op_type = OP_INSERT;
+      int k = __atomic_fetch_add(&ycsb_records_, 1, __ATOMIC_RELAXED);
+      write_entry(thread, replace_stmt, k, FLAGS_value_size);
+    } else if (p < w->update_ + w->insert_ + w->scan_) {
+      op_type = OP_SCAN;
+      int n = 1 + rand_uniform(&thread->rand_, kYcsbMaxScanLength);
+      scan_entries(thread, scan_stmt, key_gen_next(&keys, &thread->rand_), n);
+    } else if (p < w->update_ + w->insert_ + w->scan_ +
+                   w->read_modify_write_) {
+      op_type = OP_READ_MODIFY_WRITE;
+      int k = key_gen_next(&keys, &thread->rand_);
+      read_entry(thread, read_stmt, k);
+      write_entry(thread, replace_stmt, k, FLAGS_value_size);
+    } else {
+      op_type = OP_READ;
+      read_entry(thread, read_stmt, key_gen_next(&keys, &thread->rand_));
+    }
+    finished_single_op(thread, op_type);
+  }
+  thread->measure_latency_ = false;
+
+  status = sqlite3_finalize(read_stmt);
+  error_check(status);
+  status = sqlite3_finalize(replace_stmt);
+  error_check(status);
+  status = sqlite3_finalize(scan_stmt);
+  error_check(status);
+}
+
+/* Next key of the current workload phase */
+static int phase_key(ThreadState* thread, KeyGenerator* keys) {
+  if (phase_->sequential_) {
+    return __atomic_fetch_add(&phase_next_key_, 1, __ATOMIC_RELAXED) %
+           phase_keys_;
+  }
+  return key_gen_next(keys, &thread->rand_);
+}
+
+/*
+ * One thread of a --workload phase: ops drawn from the phase's mix until
+ * it has done ops_ of them or seconds_ have passed, batch_ ops to a
+ * transaction.
+ */
+static void run_phase(ThreadState* thread) {
+  const WorkloadPhase* p = phase_;
+  char* err_msg = NULL;
+  int status;
+  sqlite3_stmt *read_stmt, *replace_stmt, *delete_stmt, *scan_stmt;
+  sqlite3_stmt *begin_trans_stmt, *end_trans_stmt;
+  char* read_str = "SELECT * FROM test WHERE key = ?";
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+  char* delete_str = "DELETE FROM test WHERE key = ?";
+  char* scan_str =
+          "SELECT key, value FROM test WHERE key >= ? ORDER BY key LIMIT ?";
+  /* A phase that writes takes the write lock up front, since a deferred
+   * transaction that has read gets SQLITE_BUSY, without waiting, when it
+   * cannot upgrade while another thread writes */
+  char* begin_trans_str = workload_writes(p) ? "BEGIN IMMEDIATE" :
+                                               "BEGIN TRANSACTION";
+  char* end_trans_str = "END TRANSACTION";
+  /* mix_ is cumulative, so this is the chance of an insert */
+  bool grows = p->key_space_ == 0 && p->mix_[OP_INSERT] > p->mix_[OP_UPDATE];
+  KeyGenerator keys;
+  key_gen_init(&keys, p->key_dist_, phase_keys_, p->zipf_theta_,
+               p->hot_ops_fraction_, p->hot_keys_fraction_);
+
+  char* sync_stmt = p->sync_ ? "PRAGMA synchronous = FULL" :
+                               "PRAGMA synchronous = OFF";
+  status = sqlite3_exec(thread->db_, sync_stmt, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+
+  /* Preparing sqlite3 statements */
+  status = sqlite3_prepare_v2(thread->db_, read_str, -1, &read_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, replace_str, -1, &replace_stmt,
+                              NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, delete_str, -1, &delete_stmt,
+                              NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, scan_str, -1, &scan_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, begin_trans_str, -1,
+                              &begin_trans_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(thread->db_, end_trans_str, -1,
+                              &end_trans_stmt, NULL);
+  error_check(status);
+
+  bool transaction = FLAGS_transaction && p->batch_ > 1;
+  uint64_t deadline = p->seconds_ > 0 ?
+                      now_nanos() + (uint64_t)(p->seconds_ * 1e9) : 0;
+  int in_batch = 0;
+  thread->measure_latency_ = true;
+  for (int64_t i = 0; p->ops_ == 0 || i < p->ops_; i++) {
+    if (deadline != 0 && now_nanos() >= deadline) break;
+    if (grows) {
+      /* Pick up keys inserted by other threads */
+      key_gen_resize(&keys,
+                     __atomic_load_n(&workload_records_, __ATOMIC_RELAXED));
+    }
+
+    /* Begin write transaction */
+    if (transaction && in_batch == 0) step_transaction(begin_trans_stmt);
+
+    int op_type = workload_next_op(p, &thread->rand_);
+    int k;
+    start_single_op(thread);
+    switch (op_type) {
+      case OP_WRITE:
+        write_entry(thread, replace_stmt, phase_key(thread, &keys),
+                    workload_value_size(p, &thread->rand_));
+        break;
+      case OP_INSERT:
+        k = __atomic_fetch_add(&workload_records_, 1, __ATOMIC_RELAXED);
+        write_entry(thread, replace_stmt, k,
+                    workload_value_size(p, &thread->rand_));
+        break;
+      case OP_DELETE:
+        delete_entry(thread, delete_stmt, phase_key(thread, &keys));
+        break;
+      case OP_SCAN:
+        scan_entries(thread, scan_stmt, phase_key(thread, &keys),
+                     workload_scan_length(p, &thread->rand_));
+        break;
+      case OP_READ_MODIFY_WRITE:
+        k = phase_key(thread, &keys);
+        read_entry(thread, read_stmt, k);
+        write_entry(thread, replace_stmt, k,
+                    workload_value_size(p, &thread->rand_));
+        break;
+      default:
+        read_entry(thread, read_stmt, phase_key(thread, &keys));
+    }
+    finished_single_op(thread, op_type);
+
+    /* End write transaction */
+    if (transaction && ++in_batch == p->batch_) {
+      step_transaction(end_trans_stmt);
+      in_batch = 0;
+    }
+  }
+  if (in_batch > 0) step_transaction(end_trans_stmt);
+  thread->measure_latency_ = false;
+
+  status = sqlite3_finalize(read_stmt);
+  error_check(status);
+  status = sqlite3_finalize(replace_stmt);
+  error_check(status);
+  status = sqlite3_finalize(delete_stmt);
+  error_check(status);
+  status = sqlite3_finalize(scan_stmt);
+  error_check(status);
+  status = sqlite3_finalize(begin_trans_stmt);
+  error_check(status);
+  status = sqlite3_finalize(end_trans_stmt);
+  error_check(status);
+}
+
+/* Bind the values recorded for one statement execution */
+static int bind_trace_params(sqlite3_stmt* stmt, const TraceRecord* r) {
+  int status = SQLITE_OK;
+  int n = sqlite3_bind_parameter_count(stmt);
+  for (int i = 0; i < r->num_params_ && i < n && status == SQLITE_OK; i++) {
+    const TraceParam* p = &r->params_[i];
+    switch (p->type_) {
+      case 'I':
+        status = sqlite3_bind_int64(stmt, i + 1, p->int_);
+        break;
+      case 'F':
+        status = sqlite3_bind_double(stmt, i + 1, p->real_);
+        break;
+      case 'T':
+        status = sqlite3_bind_text(stmt, i + 1, p->data_, p->len_,
+                                   SQLITE_STATIC);
+        break;
+      case 'B':
+        status = sqlite3_bind_blob(stmt, i + 1, p->data_, p->len_,
+                                   SQLITE_STATIC);
+        break;
+      case 'Z':
+        status = sqlite3_bind_zeroblob(stmt, i + 1, (int)p->int_);
+        break;
+      default:
+        status = sqlite3_bind_null(stmt, i + 1);
+    }
+  }
+  return status;
+}
+
+/*
+ * Wait until the connections that the trace shows finishing before this
+ * one started have closed; run flat out, they would otherwise overlap.
+ */
+static void replay_wait_for_earlier(ThreadState* thread) {
+  const TraceStream* stream = &trace_.streams_[thread->tid_];
+  SharedState* shared = thread->shared_;
+  pthread_mutex_lock(&shared->mu_);
+  for (int i = 0; i < trace_.num_streams_; i++) {
+    const TraceStream* other = &trace_.streams_[i];
+    if (other->records_[other->num_records_ - 1].nanos_ >=
+        stream->records_[0].nanos_) {
+      continue;
+    }
+    while (!replay_closed_[i]) {
+      pthread_cond_wait(&shared->cv_, &shared->mu_);
+    }
+  }
+  pthread_mutex_unlock(&shared->mu_);
+}
+
+/*
+ * One connection of the --replay trace: its statements in order, each
+ * distinct one prepared once and kept.  With --replay_speed a statement
+ * waits until its recorded start, scaled, before it runs.  A statement
+ * that fails is counted against its fingerprint and the replay goes on.
+ */
+static void replay_connection(ThreadState* thread) {
+  const TraceStream* stream = &trace_.streams_[thread->tid_];
+  int fingerprints = trace_.num_fingerprints_;
+  Histogram* hists = &replay_hists_[thread->tid_ * fingerprints];
+  int64_t* errors = &replay_errors_[thread->tid_ * fingerprints];
+  sqlite3_stmt** stmts = calloc(trace_.num_sql_, sizeof(sqlite3_stmt*));
+  uint64_t start = 0;
+  if (FLAGS_replay_speed > 0) {
+    /* All connections keep time from when the first one started */
+    uint64_t unset = 0;
+    __atomic_compare_exchange_n(&replay_start_, &unset, now_nanos(), false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    start = __atomic_load_n(&replay_start_, __ATOMIC_RELAXED);
+  }
+  replay_wait_for_earlier(thread);
+
+  thread->measure_latency_ = true;
+  for (int i = 0; i < stream->num_records_; i++) {
+    const TraceRecord* r = &stream->records_[i];
+    int fp = trace_.fingerprint_of_[r->sql_];
+    if (FLAGS_replay_speed > 0) {
+      uint64_t due = start + (uint64_t)((r->nanos_ - trace_.start_nanos_) /
+                                        FLAGS_replay_speed);
+      uint64_t now = now_nanos();
+      if (now > due && now - due > replay_lag_[thread->tid_]) {
+        replay_lag_[thread->tid_] = now - due;
+      }
+      while (now < due) {
+        /* Sleep for the bulk of the wait and spin for the rest */
+        uint64_t wait = due - now;
+        if (wait > 200000) {
+          sleep_micros((wait - 100000) / 1000);
+        }
+        now = now_nanos();
+      }
+    }
+
+    /* Time the statement, not the wait for its turn */
+    uint64_t op_start = now_nanos();
+    thread->stats_.last_op_finish_ = op_start;
+    int status = SQLITE_OK;
+    if (stmts[r->sql_] == NULL) {
+      status = sqlite3_prepare_v2(thread->db_, trace_.sql_[r->sql_], -1,
+                                  &stmts[r->sql_], NULL);
+    }
+    sqlite3_stmt* stmt = stmts[r->sql_];
+    if (stmt != NULL) {
+      status = bind_trace_params(stmt, r);
+      if (status == SQLITE_OK) {
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+          thread->stats_.rows_++;
+        }
+      }
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+    }
+    if (status != SQLITE_OK && status != SQLITE_DONE) errors[fp]++;
+    histogram_add(&hists[fp], (double)(now_nanos() - op_start));
+    finished_single_op(thread, stmt != NULL && !sqlite3_stmt_readonly(stmt) ?
+                               OP_WRITE : OP_READ);
+  }
+  thread->measure_latency_ = false;
+
+  for (int i = 0; i < trace_.num_sql_; i++) {
+    sqlite3_finalize(stmts[i]);
+  }
+  free(stmts);
+
+  /* Close as the traced connection did, releasing its locks and waking the
+   * connections that come after it */
+  if (FLAGS_alloc_stats) {
+    lookaside_counts(thread->db_, &thread->stats_.lookaside_hits_,
+                     &thread->stats_.lookaside_misses_);
+  }
+  int status = sqlite3_close(thread->db_);
+  error_check(status);
+  thread->db_ = NULL;
+  SharedState* shared = thread->shared_;
+  pthread_mutex_lock(&shared->mu_);
+  replay_closed_[thread->tid_] = true;
+  pthread_cond_broadcast(&shared->cv_);
+  pthread_mutex_unlock(&shared->mu_);
+}
@@ -5,48 +5,77 @@
 #include "bench.h"
 
 static double median(Histogram*);
-static double percentile(Histogram*, double);
 static double average(Histogram*);
 static double standard_deviation(Histogram*);
 
-const static double bucket_limit[kNumBuckets] = {
-  1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 14, 16, 18, 20, 25, 30, 35, 40, 45,
-  50, 60, 70, 80, 90, 100, 120, 140, 160, 180, 200, 250, 300, 350, 400, 450,
-  500, 600, 700, 800, 900, 1000, 1200, 1400, 1600, 1800, 2000, 2500, 3000,
-  3500, 4000, 4500, 5000, 6000, 7000, 8000, 9000, 10000, 12000, 14000,
-  16000, 18000, 20000, 25000, 30000, 35000, 40000, 45000, 50000, 60000,
-  70000, 80000, 90000, 100000, 120000, 140000, 160000, 180000, 200000,
-  250000, 300000, 350000, 400000, 450000, 500000, 600000, 700000, 800000,
-  900000, 1000000, 1200000, 1400000, 1600000, 1800000, 2000000, 2500000,
-  3000000, 3500000, 4000000, 4500000, 5000000, 6000000, 7000000, 8000000,
-  9000000, 10000000, 12000000, 14000000, 16000000, 18000000, 20000000,
-  25000000, 30000000, 35000000, 40000000, 45000000, 50000000, 60000000,
-  70000000, 80000000, 90000000, 100000000, 120000000, 140000000, 160000000,
-  180000000, 200000000, 250000000, 300000000, 350000000, 400000000,
-  450000000, 500000000, 600000000, 700000000, 800000000, 900000000,
-  1000000000, 1200000000, 1400000000, 1600000000, 1800000000, 2000000000,
-  2500000000.0, 3000000000.0, 3500000000.0, 4000000000.0, 4500000000.0,
-  5000000000.0, 6000000000.0, 7000000000.0, 8000000000.0, 9000000000.0,
-  1e200,
-};
+/*
+ * Bucket layout for the given number of significant digits.  The first
+ * bucket holds sub_bucket_count values at unit resolution; every further
+ * bucket covers twice the range of the previous one with the upper half of
+ * its sub-buckets, so that the relative error stays below 10^-digits.
+ */
+static void histogram_layout(Histogram* hist_, int digits) {
+  int64_t largest = 2;
+  for (int i = 0; i < digits; i++) largest *= 10;
+  int magnitude = (int)ceil(log2((double)largest));
+  int64_t sub_bucket_count = (int64_t)1 << magnitude;
 
-static double median(Histogram* hist_) {
-  return percentile(hist_, 50.0);
+  int buckets = 1;
+  int64_t smallest_untrackable = sub_bucket_count;
+  while (smallest_untrackable <= kHistogramMaxValue) {
+    smallest_untrackable <<= 1;
+    buckets++;
+  }
+
+  hist_->digits_ = digits;
+  hist_->sub_bucket_half_count_magnitude_ = magnitude - 1;
+  hist_->sub_bucket_half_count_ = (int)(sub_bucket_count / 2);
+  hist_->sub_bucket_mask_ = sub_bucket_count - 1;
+  hist_->counts_len_ = (buckets + 1) * hist_->sub_bucket_half_count_;
 }
 
-static double percentile(Histogram* hist_, double p) {
-  double threshold = hist_->num_ * (p / 100.0);
-  double sum = 0;
-  for (int b = 0; b < kNumBuckets; b++) {
-    sum += hist_->buckets_[b];
+static int counts_index(const Histogram* hist_, int64_t value) {
+  int pow2ceiling =
+    64 - __builtin_clzll((uint64_t)(value | hist_->sub_bucket_mask_));
+  int bucket = pow2ceiling - (hist_->sub_bucket_half_count_magnitude_ + 1);
+  int sub_bucket = (int)(value >> bucket);
+  return ((bucket + 1) << hist_->sub_bucket_half_count_magnitude_) +
+         (sub_bucket - hist_->sub_bucket_half_count_);
+}
+
+/* Largest value that falls into the same slot as counts_[index] */
+static int64_t highest_equivalent_value(const Histogram* hist_, int index) {
+  int bucket = (index >> hist_->sub_bucket_half_count_magnitude_) - 1;
+  int64_t sub_bucket = (index & (hist_->sub_bucket_half_count_ - 1)) +
+                       hist_->sub_bucket_half_count_;
+  if (bucket < 0) {
+    sub_bucket -= hist_->sub_bucket_half_count_;
+    bucket = 0;
+  }
+  return (sub_bucket << bucket) + ((int64_t)1 << bucket) - 1;
+}
+
+int64_t histogram_bucket_value(Histogram* hist_, int index) {
+  return highest_equivalent_value(hist_, index);
+}
+
+static void histogram_alloc(Histogram* hist_) {
+  hist_->counts_ = bench_calloc(sizeof(int64_t), hist_->counts_len_);
+  if (!hist_->counts_) {
+    fprintf(stderr, "calloc failed\n");
+    exit(1);
+  }
+}
+
+double histogram_percentile(Histogram* hist_, double p) {
+  if (hist_->num_ == 0.0 || !hist_->counts_) return 0;
+  int64_t threshold = (int64_t)ceil(hist_->num_ * (p / 100.0));
+  if (threshold < 1) threshold = 1;
+  int64_t sum = 0;
+  for (int i = 0; i < hist_->counts_len_; i++) {
+    sum += hist_->counts_[i];
     if (sum >= threshold) {
-      /* Scale linearly within this bucket */
-      double left_point = (b == 0) ? 0 : bucket_limit[b - 1];
-      double right_point = bucket_limit[b];
-      double left_sum = sum - hist_->buckets_[b];
-      double right_sum = sum;
-      double pos = (threshold - left_sum) / (right_sum - left_sum);
-      double r = left_point + (right_point - left_point) * pos;
+      double r = highest_equivalent_value(hist_, i);
       if (r < hist_->min_) r = hist_->min_;
       if (r > hist_->max_) r = hist_->max_;
       return r;
@@ -55,6 +84,10 @@ static double percentile(Histogram* hist_, double p) {
   return hist_->max_;
 }
 
+static double median(Histogram* hist_) {
+  return histogram_percentile(hist_, 50.0);
+}
+
 static double average(Histogram* hist_) {
   if (hist_->num_ == 0.0) return 0;
   return hist_->sum_ / hist_->num_;
@@ -67,37 +100,53 @@ static double standard_deviation(Histogram* hist_) {
 }
 
 void histogram_clear(Histogram* hist_) {
-  hist_->min_ = bucket_limit[kNumBuckets - 1];
+  hist_->min_ = (double)kHistogramMaxValue;
   hist_->max_ = 0;
   hist_->num_ = 0;
   hist_->sum_ = 0;
   hist_->sum_squares_ = 0;
-  for (int i = 0; i < kNumBuckets; i++) {
-    hist_->buckets_[i] = 0;
+  if (hist_->counts_ && hist_->digits_ != FLAGS_histogram_digits) {
+    histogram_free(hist_);
+  }
+  histogram_layout(hist_, FLAGS_histogram_digits);
+  if (hist_->counts_) {
+    memset(hist_->counts_, 0, sizeof(int64_t) * hist_->counts_len_);
   }
 }
+
 void histogram_add(Histogram* hist_, double value) {
-  int b = 0;
-  while (b < kNumBuckets - 1 && bucket_limit[b] <= value) {
-    b++;
-  }
-  hist_->buckets_[b] += 1.0;
+  int64_t v = (int64_t)value;
+  if (v < 0) v = 0;
+  if (v > kHistogramMaxValue) v = kHistogramMaxValue;
+  if (!hist_->counts_) histogram_alloc(hist_);
+  hist_->counts_[counts_index(hist_, v)]++;
   if (hist_->min_ > value) hist_->min_ = value;
   if (hist_->max_ < value) hist_->max_ = value;
   hist_->num_++;
   hist_->sum_ += value;
   hist_->sum_squares_ += (value * value);
 }
+
 void histogram_merge(Histogram* hist_, const Histogram* other_) {
+  if (other_->num_ == 0.0) return;
+  assert(hist_->digits_ == other_->digits_);
   if (other_->min_ < hist_->min_) hist_->min_ = other_->min_;
   if (other_->max_ > hist_->max_) hist_->max_ = other_->max_;
   hist_->num_ += other_->num_;
   hist_->sum_ += other_->sum_;
   hist_->sum_squares_ += other_->sum_squares_;
-  for (int b = 0; b < kNumBuckets; b++) {
-    hist_->buckets_[b] += other_->buckets_[b];
+  if (!hist_->counts_) histogram_alloc(hist_);
+  for (int i = 0; i < hist_->counts_len_; i++) {
+    hist_->counts_[i] += other_->counts_[i];
   }
 }
+
+void histogram_free(Histogram* hist_) {
+  if (hist_->counts_)
+    free(hist_->counts_);
+  hist_->counts_ = NULL;
+}
+
 char* histogram_to_string(Histogram* hist_) {
   size_t r_size = 1024;
   char* r = malloc(sizeof(char) * 1024);
@@ -120,38 +169,92 @@ char* histogram_to_string(Histogram* hist_) {
     r_size *= 2;
   }
   strcat(r, buf);
+  snprintf(buf, sizeof(buf),
+            "Percentiles: P50: %.0f P90: %.0f P99: %.0f P99.9: %.0f "
+            "P99.99: %.0f\n",
+            histogram_percentile(hist_, 50.0),
+            histogram_percentile(hist_, 90.0),
+            histogram_percentile(hist_, 99.0),
+            histogram_percentile(hist_, 99.9),
+            histogram_percentile(hist_, 99.99));
   if (r_size < strlen(r) + strlen(buf)) {
     r = realloc(r, r_size * 2);
     r_size *= 2;
   }
+  strcat(r, buf);
+  if (r_size < strlen(r) + 200) {
+    r = realloc(r, r_size * 2);
+    r_size *= 2;
+  }
   strcat(r, "------------------------------------------------------\n");
-  const double mult = 100.0 / hist_->num_;
-  double sum = 0;
-  for (int b = 0; b < kNumBuckets; b++) {
-    if (hist_->buckets_[b] <= 0.0) continue;
-    sum += hist_->buckets_[b];
-    snprintf(buf, sizeof(buf),
-              "[ %7.0f, %7.0f ) %7.0f %7.3f%% %7.3f%%",
-              ((b == 0) ? 0.0 : bucket_limit[b - 1]),
-              bucket_limit[b],
-              hist_->buckets_[b],
-              mult * hist_->buckets_[b],
-              mult * sum);
-    if (r_size < strlen(r) + strlen(buf)) {
+  strcat(r, "       Value   Percentile 1/(1-Percentile)\n");
+
+  /* Percentile spectrum, halving the distance to 100% on each line */
+  for (double tail = 0.5; hist_->num_ > 0; tail /= 2) {
+    double p = (tail * hist_->num_ < 1.0) ? 100.0 : 100.0 * (1.0 - tail);
+    if (p < 100.0) {
+      snprintf(buf, sizeof(buf), "%12.0f %11.6f%% %16.2f\n",
+                histogram_percentile(hist_, p), p, 1.0 / tail);
+    } else {
+      snprintf(buf, sizeof(buf), "%12.0f %11.6f%%\n", hist_->max_, p);
+    }
+    if (r_size < strlen(r) + strlen(buf) + 1) {
       r = realloc(r, r_size * 2);
       r_size *= 2;
     }
     strcat(r, buf);
+    if (p == 100.0) break;
+  }
+  return r;
+}
 
-    /* Add hash marks based on percentage; 20 marks for 100%. */
-    int marks = (int)(20 * (hist_->buckets_[b] / hist_->num_) + 0.5);
-    if (r_size < strlen(r) + marks + 1) {
-      r = realloc(r, r_size * 2);
-      r_size *= 2;
+/*
+ * Serialize hist_ under name as one header line followed by the non-empty
+ * slots, so histograms from separate threads or runs can be merged later.
+ */
+void histogram_write(FILE* f, const char* name, Histogram* hist_) {
+  int nonempty = 0;
+  for (int i = 0; hist_->counts_ && i < hist_->counts_len_; i++) {
+    if (hist_->counts_[i] > 0) nonempty++;
+  }
+  fprintf(f, "histogram %s %d %.17g %.17g %.17g %.17g %.17g %d\n",
+          name, hist_->digits_, hist_->num_, hist_->min_, hist_->max_,
+          hist_->sum_, hist_->sum_squares_, nonempty);
+  for (int i = 0; hist_->counts_ && i < hist_->counts_len_; i++) {
+    if (hist_->counts_[i] > 0)
+      fprintf(f, "%d %" PRId64 "\n", i, hist_->counts_[i]);
+  }
+}
+
+/*
+ * Read the next histogram written by histogram_write() into hist_, which
+ * must have been cleared, and its name into name.  Returns false at end of
+ * file or on malformed input.
+ */
+bool histogram_read(FILE* f, char* name, size_t name_size, Histogram* hist_) {
+  char fmt[32];
+  int digits, nonempty;
+  snprintf(fmt, sizeof(fmt), " histogram %%%zus %%d", name_size - 1);
+  if (fscanf(f, fmt, name, &digits) != 2 ||
+      fscanf(f, "%lf %lf %lf %lf %lf %d", &hist_->num_, &hist_->min_,
+             &hist_->max_, &hist_->sum_, &hist_->sum_squares_,
+             &nonempty) != 6) {
+    return false;
+  }
+  if (digits != hist_->digits_) {
+    fprintf(stderr, "histogram %s has %d digits, expected %d\n",
+            name, digits, hist_->digits_);
+    return false;
+  }
+  if (!hist_->counts_) histogram_alloc(hist_);
+  for (int i = 0; i < nonempty; i++) {
+    int index;
+    int64_t count;
+    if (fscanf(f, "%d %" SCNd64, &index, &count) != 2 ||
+        index < 0 || index >= hist_->counts_len_) {
+      return false;
     }
-    for (int i = 0; i < marks; i++)
-      strcat(r, "#");
-    strcat(r, "\n");
+    hist_->counts_[index] = count;
   }
-  return r;
+  return true;
 }
@@ -4,6 +4,8 @@
 
 #include "bench.h"
 
+#include <limits.h>
+
 // Comma-separated list of operations to run in the specified order
 //   Actual benchmarks:
 //
@@ -17,10 +19,35 @@
 //   fillrand100K  -- write N/1000 100K values in random order in async mode
 //   fillseq100K   -- write N/1000 100K values in sequential order in async mode
 //   readseq       -- read N times sequentially
+//   readreverse   -- read N times in reverse order
 //   readrandom    -- read N times in random order
+//   seekrandom    -- seek N times to random keys
+//   scanrandom    -- seek N times to random keys and read scan_length rows
 //   readrand100K  -- read N/1000 100K values in sequential order in async mode
+//   readwhilewriting -- read N times in random order while a writer overwrites
+//   ycsb_a        -- YCSB A: 50% read, 50% update, zipfian
+//   ycsb_b        -- YCSB B: 95% read, 5% update, zipfian
+//   ycsb_c        -- YCSB C: 100% read, zipfian
+//   ycsb_d        -- YCSB D: 95% read, 5% insert, latest
+//   ycsb_e        -- YCSB E: 95% short scan, 5% insert, zipfian
+//   ycsb_f        -- YCSB F: 50% read, 50% read-modify-write, zipfian
 char* FLAGS_benchmarks;
 
+// If set, run the phases of this workload file instead of --benchmarks
+char* FLAGS_workload;
+
+// If set, replay the statements of this trace file instead of --benchmarks
+char* FLAGS_replay;
+
+// Database to replay against; if NULL, a new benchmark database
+char* FLAGS_replay_db;
+
+// Multiple of the recorded pace to replay at; 0 for as fast as possible
+double FLAGS_replay_speed;
+
+// If set, record every statement run to this file in the --replay format
+char* FLAGS_trace_out;
+
 // Number of key/values to place in database
 int FLAGS_num;
 
@@ -61,6 +88,140 @@ bool FLAGS_WAL_enabled;
 // Use the db with the following name.
 char* FLAGS_db;
 
+// Issue operations open-loop at this many ops per second in total.  Each
+// thread keeps its own schedule at its share of the rate, and latency is
+// measured from each op's scheduled start time.
+// If zero, each op is issued as soon as the previous one finishes.
+double FLAGS_target_rate;
+
+// Arrival process for --target_rate: "constant" or "poisson"
+char* FLAGS_arrival;
+
+// Distribution of keys for random reads and writes: uniform, zipfian,
+// scrambled_zipfian, hotspot or latest
+char* FLAGS_key_dist;
+
+// Skew of the zipfian, scrambled_zipfian and latest distributions
+double FLAGS_zipf_theta;
+
+// For the hotspot distribution, this fraction of operations goes to
+// the first FLAGS_hotspot_keys_fraction of the key space
+double FLAGS_hotspot_ops_fraction;
+double FLAGS_hotspot_keys_fraction;
+
+// Number of rows read after each seek by scanrandom
+int FLAGS_scan_length;
+
+// Number of concurrent threads to run.  Each thread uses its own
+// connection.  Read benchmarks are repeated for 1..N threads to
+// report scaling.
+int FLAGS_threads;
+
+// If positive, emit ops/s, MB/s and latency percentiles of each
+// benchmark thread every FLAGS_stats_interval seconds
+double FLAGS_stats_interval;
+
+// Format of the --stats_interval samples: "csv" or "json"
+char* FLAGS_stats_format;
+
+// File the --stats_interval samples are written to; stdout if NULL
+char* FLAGS_stats_file;
+
+// If positive, keep a uniform sample of this many latencies per
+// benchmark for --raw instead of all of them
+int FLAGS_raw_sample;
+
+// With --raw_sample, always keep latencies of at least this many ns
+double FLAGS_raw_threshold;
+
+// If set, stream every op's latency to this file in binary form
+char* FLAGS_raw_file;
+
+// If set, write the --raw_file log at this path as CSV to stdout and exit
+char* FLAGS_decode_raw;
+
+// If true, count I/O calls, bytes and latency through a VFS shim and
+// report them per benchmark
+bool FLAGS_vfs_stats;
+
+// If set, write a report of the run; "json:PATH" writes JSON to PATH
+char* FLAGS_report;
+
+// Where databases are kept: "disk" (files under FLAGS_db) or "memory"
+// (shared between the connections of the process)
+char* FLAGS_storage;
+
+// If true, issue database I/O through io_uring, batching writes
+bool FLAGS_io_uring;
+
+// With --io_uring, write from buffers registered with the ring
+bool FLAGS_io_uring_registered;
+
+// If true, open database and WAL files with O_DIRECT, bypassing the
+// page cache
+bool FLAGS_direct_io;
+
+// If not negative, PRAGMA mmap_size of every connection
+int64_t FLAGS_mmap_size;
+
+// madvise() advice for the database mapping with --mmap_size: "none"
+// (leave it alone), "normal", "random", "sequential" or "willneed"
+char* FLAGS_madvise;
+
+// If true, report page faults per op; implied by --mmap_size
+bool FLAGS_fault_stats;
+
+// Page cache: "default" (SQLite's own), "arena", "clock" or "hugepage"
+char* FLAGS_pcache;
+
+// Latency injected into xRead, xWrite and xSync calls by a VFS shim:
+// "fixed:MICROS", "uniform:MIN,MAX" or "file:PATH"; none if NULL
+char* FLAGS_read_delay;
+char* FLAGS_write_delay;
+char* FLAGS_sync_delay;
+
+// If positive, limit reads and writes together to this many MB/s
+double FLAGS_io_throughput;
+
+// Significant decimal digits kept by latency histograms (1-4)
+int FLAGS_histogram_digits;
+
+// If set, append each benchmark's latency histogram to this file
+char* FLAGS_histogram_out;
+
+// If set, merge the comma-separated histogram files written with
+// --histogram_out, report them and exit
+char* FLAGS_histogram_merge;
+
+// Clock used for timing: "monotonic" or "tsc"
+char* FLAGS_clock;
+
+// If true, count the allocations made by the harness and by SQLite and
+// report them per op.
+bool FLAGS_alloc_stats;
+
+// SQLite's allocator: "system" (malloc), "memsys5" or "pool"
+char* FLAGS_sqlite_malloc;
+
+// Bytes preallocated for the memsys5 and pool allocators
+int64_t FLAGS_heap_size;
+
+// If not negative, bytes per lookaside slot of each connection
+int FLAGS_lookaside_size;
+
+// If not negative, lookaside slots of each connection (0 disables it)
+int FLAGS_lookaside_count;
+
+// SQLite threading mode: "single", "multi" or "serialized"
+char* FLAGS_threading;
+
+// Per-connection mutexing: "default" (the threading mode's), "nomutex"
+// (SQLITE_OPEN_NOMUTEX) or "fullmutex" (SQLITE_OPEN_FULLMUTEX)
+char* FLAGS_open_mutex;
+
+// If true, time SQLite's mutex calls and report them per op
+bool FLAGS_mutex_stats;
+
 void init() {
   // Comma-separated list of operations to run in the specified order
   //   Actual benchmarks:
@@ -75,8 +236,18 @@ void init() {
   //   fillrand100K  -- write N/1000 100K values in random order in async mode
   //   fillseq100K   -- write N/1000 100K values in sequential order in async mode
   //   readseq       -- read N times sequentially
+  //   readreverse   -- read N times in reverse order
   //   readrandom    -- read N times in random order
+  //   seekrandom    -- seek N times to random keys
+  //   scanrandom    -- seek N times to random keys and read scan_length rows
   //   readrand100K  -- read N/1000 100K values in sequential order in async mode
+  //   readwhilewriting -- read N times in random order while a writer overwrites
+  //   ycsb_a        -- YCSB A: 50% read, 50% update, zipfian
+  //   ycsb_b        -- YCSB B: 95% read, 5% update, zipfian
+  //   ycsb_c        -- YCSB C: 100% read, zipfian
+  //   ycsb_d        -- YCSB D: 95% read, 5% insert, latest
+  //   ycsb_e        -- YCSB E: 95% short scan, 5% insert, zipfian
+  //   ycsb_f        -- YCSB F: 50% read, 50% read-modify-write, zipfian
   FLAGS_benchmarks =
     "fillseq,"
     "fillseqsync,"
@@ -93,6 +264,11 @@ void init() {
     "readseq,"
     "readrand100K,"
     ;
+  FLAGS_workload = NULL;
+  FLAGS_replay = NULL;
+  FLAGS_replay_db = NULL;
+  FLAGS_replay_speed = 0;
+  FLAGS_trace_out = NULL;
   FLAGS_num = 1000000;
   FLAGS_reads = -1;
   FLAGS_value_size = 100;
@@ -105,6 +281,47 @@ void init() {
   FLAGS_transaction = true;
   FLAGS_WAL_enabled = true;
   FLAGS_db = NULL;
+  FLAGS_threads = 1;
+  FLAGS_scan_length = 100;
+  FLAGS_target_rate = 0;
+  FLAGS_arrival = "constant";
+  FLAGS_key_dist = "uniform";
+  FLAGS_zipf_theta = 0.99;
+  FLAGS_hotspot_ops_fraction = 0.8;
+  FLAGS_hotspot_keys_fraction = 0.2;
+  FLAGS_alloc_stats = false;
+  FLAGS_sqlite_malloc = "system";
+  FLAGS_heap_size = 64 << 20;
+  FLAGS_lookaside_size = -1;
+  FLAGS_lookaside_count = -1;
+  FLAGS_threading = "serialized";
+  FLAGS_open_mutex = "default";
+  FLAGS_mutex_stats = false;
+  FLAGS_clock = "monotonic";
+  FLAGS_histogram_digits = 3;
+  FLAGS_report = NULL;
+  FLAGS_vfs_stats = false;
+  FLAGS_storage = "disk";
+  FLAGS_io_uring = false;
+  FLAGS_io_uring_registered = false;
+  FLAGS_direct_io = false;
+  FLAGS_mmap_size = -1;
+  FLAGS_madvise = "none";
+  FLAGS_fault_stats = false;
+  FLAGS_pcache = "default";
+  FLAGS_read_delay = NULL;
+  FLAGS_write_delay = NULL;
+  FLAGS_sync_delay = NULL;
+  FLAGS_io_throughput = 0;
+  FLAGS_raw_file = NULL;
+  FLAGS_raw_sample = 0;
+  FLAGS_raw_threshold = 0;
+  FLAGS_decode_raw = NULL;
+  FLAGS_stats_interval = 0;
+  FLAGS_stats_format = "csv";
+  FLAGS_stats_file = NULL;
+  FLAGS_histogram_out = NULL;
+  FLAGS_histogram_merge = NULL;
 }
 
 void print_usage(const char* argv0) {
@@ -112,8 +329,23 @@ void print_usage(const char* argv0) {
   fprintf(stderr, "SQLite3 benchmark tool\n");
   fprintf(stderr, "[OPTION]\n");
   fprintf(stderr, "  --benchmarks=[BENCH]\t\tspecify benchmark\n");
+  fprintf(stderr, "  --workload=FILE\t\trun the phases in FILE instead\n");
+  fprintf(stderr, "  --replay=FILE\t\t\treplay the statements traced in FILE instead\n");
+  fprintf(stderr, "  --replay_db=PATH\t\treplay against PATH, not a new database\n");
+  fprintf(stderr, "  --replay_speed=DOUBLE\t\tmultiple of the traced pace; 0 for flat out\n");
+  fprintf(stderr, "  --trace_out=FILE\t\trecord the statements run to FILE\n");
   fprintf(stderr, "  --histogram={0,1}\t\trecord histogram\n");
+  fprintf(stderr, "  --histogram_digits=INT\tsignificant digits of histograms (1-4)\n");
+  fprintf(stderr, "  --histogram_out=PATH\t\tappend histograms to PATH\n");
+  fprintf(stderr, "  --histogram_merge=PATH,...\tmerge histogram files and exit\n");
+  fprintf(stderr, "  --stats_interval=SECONDS\temit a time series every SECONDS\n");
+  fprintf(stderr, "  --stats_format={csv,json}\ttime series format\n");
+  fprintf(stderr, "  --stats_file=PATH\t\twrite time series to PATH\n");
   fprintf(stderr, "  --raw={0,1}\t\t\toutput raw data\n");
+  fprintf(stderr, "  --raw_sample=INT\t\tkeep a sample of INT raw latencies\n");
+  fprintf(stderr, "  --raw_threshold=NANOS\t\talso keep all raw latencies >= NANOS\n");
+  fprintf(stderr, "  --raw_file=PATH\t\tstream binary raw data to PATH\n");
+  fprintf(stderr, "  --decode_raw=PATH\t\tprint a raw_file as CSV and exit\n");
   fprintf(stderr, "  --compression_ratio=DOUBLE\tcompression ratio\n");
   fprintf(stderr, "  --use_existing_db={0,1}\tuse existing database\n");
   fprintf(stderr, "  --num=INT\t\t\tnumber of entries\n");
@@ -124,6 +356,43 @@ void print_usage(const char* argv0) {
   fprintf(stderr, "  --num_pages=INT\t\tnumber of pages\n");
   fprintf(stderr, "  --WAL_enabled={0,1}\t\tenable WAL\n");
   fprintf(stderr, "  --db=PATH\t\t\tpath to location databases are created\n");
+  fprintf(stderr, "  --storage={disk,memory}\tkeep databases on disk or in memory\n");
+  fprintf(stderr, "  --io_uring={0,1}\t\tdo database I/O through io_uring\n");
+  fprintf(stderr, "  --io_uring_registered={0,1}\tuse registered io_uring buffers\n");
+  fprintf(stderr, "  --direct_io={0,1}\t\tbypass the page cache with O_DIRECT\n");
+  fprintf(stderr, "  --mmap_size=BYTES\t\tPRAGMA mmap_size of each connection\n");
+  fprintf(stderr, "  --madvise=ADVICE\t\tadvice for the mmap: none, normal,\n"
+                  "\t\t\t\trandom, sequential, willneed\n");
+  fprintf(stderr, "  --fault_stats={0,1}\t\treport page faults per op\n");
+  fprintf(stderr, "  --pcache=CACHE\t\tpage cache: default, arena, clock,\n"
+                  "\t\t\t\thugepage\n");
+  fprintf(stderr, "  --threads=INT\t\t\tnumber of reader threads\n");
+  fprintf(stderr, "  --scan_length=INT\t\trows read per seek by scanrandom\n");
+  fprintf(stderr, "  --target_rate=DOUBLE\t\topen-loop ops per second\n");
+  fprintf(stderr, "  --arrival={constant,poisson}\topen-loop arrival process\n");
+  fprintf(stderr, "  --key_dist=DIST\t\tkey distribution: uniform, zipfian,\n"
+                  "\t\t\t\tscrambled_zipfian, hotspot, latest\n");
+  fprintf(stderr, "  --zipf_theta=DOUBLE\t\tzipfian skew\n");
+  fprintf(stderr, "  --hotspot_ops_fraction=DOUBLE\tfraction of ops to hot keys\n");
+  fprintf(stderr, "  --hotspot_keys_fraction=DOUBLE\tfraction of keys that are hot\n");
+  fprintf(stderr, "  --clock={monotonic,tsc}\ttiming clock source\n");
+  fprintf(stderr, "  --alloc_stats={0,1}\t\treport allocations per op\n");
+  fprintf(stderr, "  --sqlite_malloc=ALLOC\t\tSQLite allocator: system, memsys5, pool\n");
+  fprintf(stderr, "  --heap_size=BYTES\t\theap for memsys5 and pool\n");
+  fprintf(stderr, "  --lookaside_size=INT\t\tbytes per lookaside slot\n");
+  fprintf(stderr, "  --lookaside_count=INT\t\tlookaside slots per connection\n");
+  fprintf(stderr, "  --threading=MODE\t\tSQLite threading mode: single, multi,\n"
+                  "\t\t\t\tserialized\n");
+  fprintf(stderr, "  --open_mutex=MUTEX\t\tconnection mutexing: default, nomutex,\n"
+                  "\t\t\t\tfullmutex\n");
+  fprintf(stderr, "  --mutex_stats={0,1}\t\treport mutex calls per op\n");
+  fprintf(stderr, "  --vfs_stats={0,1}\t\treport I/O calls per benchmark\n");
+  fprintf(stderr, "  --read_delay=DELAY\t\tinject DELAY into each read: fixed:MICROS,\n"
+                  "\t\t\t\tuniform:MIN,MAX or file:PATH\n");
+  fprintf(stderr, "  --write_delay=DELAY\t\tinject DELAY into each write\n");
+  fprintf(stderr, "  --sync_delay=DELAY\t\tinject DELAY into each sync\n");
+  fprintf(stderr, "  --io_throughput=MBPS\t\tlimit reads and writes to MBPS\n");
+  fprintf(stderr, "  --report=json:PATH\t\twrite a JSON report to PATH\n");
   fprintf(stderr, "  --help\t\t\tshow this help\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "[BENCH]\n");
@@ -137,8 +406,18 @@ void print_usage(const char* argv0) {
   fprintf(stderr, "  fillrand100K\twrite N/1000 100K values in random order in async mode\n");
   fprintf(stderr, "  fillseq100K\twirte N/1000 100K values in sequential order in async mode\n");
   fprintf(stderr, "  readseq\tread N times sequentially\n");
+  fprintf(stderr, "  readreverse\tread N times in reverse order\n");
   fprintf(stderr, "  readrandom\tread N times in random order\n");
+  fprintf(stderr, "  seekrandom\tseek N times to random keys\n");
+  fprintf(stderr, "  scanrandom\tseek N times to random keys and read scan_length rows\n");
   fprintf(stderr, "  readrand100K\tread N/1000 100K values in sequential order in async mode\n");
+  fprintf(stderr, "  readwhilewriting\tread N times in random order while a writer overwrites\n");
+  fprintf(stderr, "  ycsb_a\tYCSB A: 50%% read, 50%% update, zipfian\n");
+  fprintf(stderr, "  ycsb_b\tYCSB B: 95%% read, 5%% update, zipfian\n");
+  fprintf(stderr, "  ycsb_c\tYCSB C: 100%% read, zipfian\n");
+  fprintf(stderr, "  ycsb_d\tYCSB D: 95%% read, 5%% insert, latest\n");
+  fprintf(stderr, "  ycsb_e\tYCSB E: 95%% short scan, 5%% insert, zipfian\n");
+  fprintf(stderr, "  ycsb_f\tYCSB F: 50%% read, 50%% read-modify-write, zipfian\n");
 
 }
 
@@ -151,15 +430,53 @@ int main(int argc, char** argv) {
   for (int i = 1; i < argc; i++) {
     double d;
     int n;
+    int64_t n64;
     char junk;
     if (starts_with(argv[i], "--benchmarks=")) {
       FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
+    } else if (starts_with(argv[i], "--workload=")) {
+      FLAGS_workload = argv[i] + strlen("--workload=");
+    } else if (starts_with(argv[i], "--replay=")) {
+      FLAGS_replay = argv[i] + strlen("--replay=");
+    } else if (starts_with(argv[i], "--replay_db=")) {
+      FLAGS_replay_db = argv[i] + strlen("--replay_db=");
+    } else if (sscanf(argv[i], "--replay_speed=%lf%c", &d, &junk) == 1 &&
+               d >= 0) {
+      FLAGS_replay_speed = d;
+    } else if (starts_with(argv[i], "--trace_out=")) {
+      FLAGS_trace_out = argv[i] + strlen("--trace_out=");
     } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_histogram = n;
+    } else if (sscanf(argv[i], "--histogram_digits=%d%c", &n, &junk) == 1 &&
+               n >= 1 && n <= 4) {
+      FLAGS_histogram_digits = n;
+    } else if (starts_with(argv[i], "--histogram_out=")) {
+      FLAGS_histogram_out = argv[i] + strlen("--histogram_out=");
+      FLAGS_histogram = true;
+    } else if (starts_with(argv[i], "--histogram_merge=")) {
+      FLAGS_histogram_merge = argv[i] + strlen("--histogram_merge=");
+    } else if (sscanf(argv[i], "--stats_interval=%lf%c", &d, &junk) == 1 &&
+               d >= 0) {
+      FLAGS_stats_interval = d;
+    } else if (!strcmp(argv[i], "--stats_format=csv") ||
+               !strcmp(argv[i], "--stats_format=json")) {
+      FLAGS_stats_format = argv[i] + strlen("--stats_format=");
+    } else if (starts_with(argv[i], "--stats_file=")) {
+      FLAGS_stats_file = argv[i] + strlen("--stats_file=");
     } else if (sscanf(argv[i], "--raw=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_raw = n;
+    } else if (sscanf(argv[i], "--raw_sample=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_raw_sample = n;
+    } else if (sscanf(argv[i], "--raw_threshold=%lf%c", &d, &junk) == 1 &&
+               d >= 0) {
+      FLAGS_raw_threshold = d;
+    } else if (starts_with(argv[i], "--raw_file=")) {
+      FLAGS_raw_file = argv[i] + strlen("--raw_file=");
+    } else if (starts_with(argv[i], "--decode_raw=")) {
+      FLAGS_decode_raw = argv[i] + strlen("--decode_raw=");
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
     } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1 &&
@@ -182,6 +499,101 @@ int main(int argc, char** argv) {
       FLAGS_WAL_enabled = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--scan_length=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_scan_length = n;
+    } else if (sscanf(argv[i], "--target_rate=%lf%c", &d, &junk) == 1 &&
+               d >= 0) {
+      FLAGS_target_rate = d;
+    } else if (!strcmp(argv[i], "--arrival=constant") ||
+               !strcmp(argv[i], "--arrival=poisson")) {
+      FLAGS_arrival = argv[i] + strlen("--arrival=");
+    } else if (starts_with(argv[i], "--key_dist=") &&
+               key_dist_from_string(argv[i] + strlen("--key_dist=")) >= 0) {
+      FLAGS_key_dist = argv[i] + strlen("--key_dist=");
+    } else if (sscanf(argv[i], "--zipf_theta=%lf%c", &d, &junk) == 1 &&
+               d > 0 && d < 1) {
+      FLAGS_zipf_theta = d;
+    } else if (sscanf(argv[i], "--hotspot_ops_fraction=%lf%c", &d, &junk) == 1 &&
+               d >= 0 && d <= 1) {
+      FLAGS_hotspot_ops_fraction = d;
+    } else if (sscanf(argv[i], "--hotspot_keys_fraction=%lf%c", &d, &junk) == 1 &&
+               d > 0 && d <= 1) {
+      FLAGS_hotspot_keys_fraction = d;
+    } else if (!strcmp(argv[i], "--clock=monotonic") ||
+               !strcmp(argv[i], "--clock=tsc")) {
+      FLAGS_clock = argv[i] + strlen("--clock=");
+    } else if (sscanf(argv[i], "--alloc_stats=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_alloc_stats = n;
+    } else if (!strcmp(argv[i], "--sqlite_malloc=system") ||
+               !strcmp(argv[i], "--sqlite_malloc=memsys5") ||
+               !strcmp(argv[i], "--sqlite_malloc=pool")) {
+      FLAGS_sqlite_malloc = argv[i] + strlen("--sqlite_malloc=");
+    } else if (sscanf(argv[i], "--heap_size=%" SCNd64 "%c", &n64, &junk) == 1 &&
+               n64 > 0) {
+      FLAGS_heap_size = n64;
+    } else if (sscanf(argv[i], "--lookaside_size=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_lookaside_size = n;
+    } else if (sscanf(argv[i], "--lookaside_count=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_lookaside_count = n;
+    } else if (!strcmp(argv[i], "--threading=single") ||
+               !strcmp(argv[i], "--threading=multi") ||
+               !strcmp(argv[i], "--threading=serialized")) {
+      FLAGS_threading = argv[i] + strlen("--threading=");
+    } else if (!strcmp(argv[i], "--open_mutex=default") ||
+               !strcmp(argv[i], "--open_mutex=nomutex") ||
+               !strcmp(argv[i], "--open_mutex=fullmutex")) {
+      FLAGS_open_mutex = argv[i] + strlen("--open_mutex=");
+    } else if (sscanf(argv[i], "--mutex_stats=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_mutex_stats = n;
+    } else if (sscanf(argv[i], "--vfs_stats=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_vfs_stats = n;
+    } else if (!strcmp(argv[i], "--storage=disk") ||
+               !strcmp(argv[i], "--storage=memory")) {
+      FLAGS_storage = argv[i] + strlen("--storage=");
+    } else if (sscanf(argv[i], "--io_uring=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_io_uring = n;
+    } else if (sscanf(argv[i], "--io_uring_registered=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_io_uring_registered = n;
+    } else if (sscanf(argv[i], "--direct_io=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_direct_io = n;
+    } else if (sscanf(argv[i], "--mmap_size=%" SCNd64 "%c", &n64, &junk) == 1 &&
+               n64 >= 0) {
+      FLAGS_mmap_size = n64;
+    } else if (starts_with(argv[i], "--madvise=") &&
+               (!strcmp(argv[i] + strlen("--madvise="), "none") ||
+                madvise_from_string(argv[i] + strlen("--madvise=")) >= 0)) {
+      FLAGS_madvise = argv[i] + strlen("--madvise=");
+    } else if (sscanf(argv[i], "--fault_stats=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_fault_stats = n;
+    } else if (!strcmp(argv[i], "--pcache=default") ||
+               !strcmp(argv[i], "--pcache=arena") ||
+               !strcmp(argv[i], "--pcache=clock") ||
+               !strcmp(argv[i], "--pcache=hugepage")) {
+      FLAGS_pcache = argv[i] + strlen("--pcache=");
+    } else if (starts_with(argv[i], "--read_delay=")) {
+      FLAGS_read_delay = argv[i] + strlen("--read_delay=");
+    } else if (starts_with(argv[i], "--write_delay=")) {
+      FLAGS_write_delay = argv[i] + strlen("--write_delay=");
+    } else if (starts_with(argv[i], "--sync_delay=")) {
+      FLAGS_sync_delay = argv[i] + strlen("--sync_delay=");
+    } else if (sscanf(argv[i], "--io_throughput=%lf%c", &d, &junk) == 1 &&
+               d >= 0) {
+      FLAGS_io_throughput = d;
+    } else if (starts_with(argv[i], "--report=json:")) {
+      FLAGS_report = argv[i] + strlen("--report=");
     } else if (!strcmp(argv[i], "--help")) {
       print_usage(argv[0]);
       exit(0);
@@ -195,6 +607,55 @@ int main(int argc, char** argv) {
   if (FLAGS_db == NULL)
       FLAGS_db = default_db_path;
 
+  if (FLAGS_use_existing_db && !strcmp(FLAGS_storage, "memory")) {
+    fprintf(stderr, "--use_existing_db requires --storage=disk\n");
+    exit(1);
+  }
+
+  if (FLAGS_replay != NULL && FLAGS_workload != NULL) {
+    fprintf(stderr, "--replay and --workload cannot be used together\n");
+    exit(1);
+  }
+  if (FLAGS_replay_db != NULL &&
+      (FLAGS_replay == NULL || !strcmp(FLAGS_storage, "memory"))) {
+    fprintf(stderr, "--replay_db requires --replay and --storage=disk\n");
+    exit(1);
+  }
+
+  if (FLAGS_io_uring && !strcmp(FLAGS_storage, "memory")) {
+    fprintf(stderr, "--io_uring requires --storage=disk\n");
+    exit(1);
+  }
+
+  if (FLAGS_direct_io && (FLAGS_io_uring || !strcmp(FLAGS_storage, "memory"))) {
+    fprintf(stderr, "--direct_io requires --storage=disk and --io_uring=0\n");
+    exit(1);
+  }
+
+  if (strcmp(FLAGS_madvise, "none") && FLAGS_mmap_size <= 0) {
+    fprintf(stderr, "--madvise requires --mmap_size\n");
+    exit(1);
+  }
+  if (FLAGS_mmap_size > 0) FLAGS_fault_stats = true;
+
+  if ((FLAGS_lookaside_size >= 0 || FLAGS_lookaside_count >= 0) &&
+      sqlite3_compileoption_used("OMIT_LOOKASIDE")) {
+    fprintf(stderr, "--lookaside_* flags need SQLite built with lookaside\n");
+    exit(1);
+  }
+  if (!strcmp(FLAGS_sqlite_malloc, "memsys5") && FLAGS_heap_size > INT_MAX) {
+    fprintf(stderr, "--sqlite_malloc=memsys5 takes a --heap_size below 2 GB\n");
+    exit(1);
+  }
+
+  if (FLAGS_decode_raw != NULL) {
+    return benchmark_decode_raw(FLAGS_decode_raw) ? 0 : 1;
+  }
+  if (FLAGS_histogram_merge != NULL) {
+    benchmark_merge_histograms(FLAGS_histogram_merge);
+    return 0;
+  }
+
   benchmark_init();
   benchmark_run();
   benchmark_fini();
@@ -0,0 +1,101 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * Mutexes this thread acquired, enter/try/leave calls it made, and the
+ * time those calls took, waiting for another thread included
+ */
+static __thread int64_t mutex_enters_;
+static __thread int64_t mutex_calls_;
+static __thread int64_t mutex_nanos_;
+
+/* The mutex implementation SQLite chose for the threading mode */
+static sqlite3_mutex_methods default_mutex_;
+
+static void timed_enter(sqlite3_mutex* m) {
+  uint64_t start = now_nanos();
+  default_mutex_.xMutexEnter(m);
+  mutex_nanos_ += now_nanos() - start;
+  mutex_calls_++;
+  mutex_enters_++;
+}
+
+static int timed_try(sqlite3_mutex* m) {
+  uint64_t start = now_nanos();
+  int rc = default_mutex_.xMutexTry(m);
+  mutex_nanos_ += now_nanos() - start;
+  mutex_calls_++;
+  if (rc == SQLITE_OK) mutex_enters_++;
+  return rc;
+}
+
+static void timed_leave(sqlite3_mutex* m) {
+  uint64_t start = now_nanos();
+  default_mutex_.xMutexLeave(m);
+  mutex_nanos_ += now_nanos() - start;
+  mutex_calls_++;
+}
+
+/* SQLITE_CONFIG_* value of a --threading mode */
+static int threading_config(const char* mode) {
+  if (!strcmp(mode, "single")) return SQLITE_CONFIG_SINGLETHREAD;
+  if (!strcmp(mode, "multi")) return SQLITE_CONFIG_MULTITHREAD;
+  return SQLITE_CONFIG_SERIALIZED;
+}
+
+/* Set the --threading mode.  Must run before SQLite is initialized. */
+void threading_init(const char* mode) {
+  if (sqlite3_threadsafe() == 0 && strcmp(mode, "single")) {
+    fprintf(stderr, "SQLite was built without threading support\n");
+    exit(1);
+  }
+  if (sqlite3_config(threading_config(mode)) != SQLITE_OK) {
+    fprintf(stderr, "failed to set threading mode %s\n", mode);
+    exit(1);
+  }
+}
+
+/* SQLITE_OPEN_* flags for --open_mutex */
+int open_mutex_flags(const char* name) {
+  if (!strcmp(name, "nomutex")) return SQLITE_OPEN_NOMUTEX;
+  if (!strcmp(name, "fullmutex")) return SQLITE_OPEN_FULLMUTEX;
+  return 0;
+}
+
+/*
+ * Time SQLite's mutex enter, try and leave calls.  SQLite only fills in
+ * its mutex methods when it is initialized, so initialize and shut it down
+ * once to learn them; call this after every other sqlite3_config().
+ */
+void mutex_stats_init() {
+  sqlite3_mutex_methods mutex;
+
+  if (sqlite3_initialize() != SQLITE_OK || sqlite3_shutdown() != SQLITE_OK) {
+    fprintf(stderr, "failed to initialize SQLite\n");
+    exit(1);
+  }
+  sqlite3_config(SQLITE_CONFIG_GETMUTEX, &default_mutex_);
+  mutex = default_mutex_;
+  mutex.xMutexEnter = timed_enter;
+  mutex.xMutexTry = timed_try;
+  mutex.xMutexLeave = timed_leave;
+  if (sqlite3_config(SQLITE_CONFIG_MUTEX, &mutex) != SQLITE_OK) {
+    fprintf(stderr, "failed to install timed mutexes\n");
+    exit(1);
+  }
+}
+
+int64_t mutex_count_enters() {
+  return mutex_enters_;
+}
+
+/*
+ * Nanoseconds this thread has spent entering and leaving SQLite's mutexes,
+ * waiting included, less the cost of reading the clock around each call.
+ */
+int64_t mutex_nanos() {
+  return mutex_nanos_ - (int64_t)(mutex_calls_ * clock_overhead_nanos());
+}
@@ -0,0 +1,482 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0
+#endif
+
+/*
+ * Page caches for --pcache, installed with SQLITE_CONFIG_PCACHE2.  All
+ * three keep pages in a per-connection hash table and differ in where page
+ * memory comes from and which page they give up when the cache is full:
+ *
+ *   arena     pages are carved from 1 MB slabs and recycled through a free
+ *             list; the least recently unpinned page is evicted
+ *   clock     every page is its own malloc(); eviction sweeps a CLOCK hand
+ *             over all pages, sparing those referenced since the last sweep
+ *   hugepage  as arena, but slabs are 2 MB huge pages (MAP_HUGETLB, or a
+ *             transparent huge page when none are reserved)
+ *
+ * A cache is only ever used by the connection that created it, so caches
+ * take no locks; SQLite serializes calls on a connection.
+ */
+
+enum PcacheKind {
+  PCACHE_ARENA,
+  PCACHE_CLOCK,
+  PCACHE_HUGEPAGE
+};
+
+#define kArenaSlabBytes (1 << 20)
+#define kHugeSlabBytes (2 << 20)
+#define kInitialBuckets 256
+
+/* A page: the page buffer and SQLite's extra bytes follow the header */
+typedef struct PcachePage {
+  sqlite3_pcache_page base_;
+  unsigned key_;
+  bool pinned_;
+  bool referenced_;              /* CLOCK: used since the hand last passed */
+  struct PcachePage* hash_next_; /* hash chain, or free list */
+  struct PcachePage* prev_;      /* arena, hugepage: unpinned pages, oldest */
+  struct PcachePage* next_;      /* first; clock: all pages in a ring */
+} PcachePage;
+
+typedef struct PcacheSlab {
+  struct PcacheSlab* next_;
+  char* mem_;
+  size_t len_;
+  bool mapped_;                  /* munmap() rather than free() */
+} PcacheSlab;
+
+typedef struct Pcache {
+  int sz_page_;
+  int sz_extra_;
+  size_t sz_slot_;
+  bool purgeable_;
+  unsigned max_;                 /* xCachesize */
+  unsigned count_;               /* pages in the hash table */
+  unsigned pinned_;
+  unsigned buckets_;             /* power of two */
+  PcachePage** hash_;
+  PcachePage list_;              /* sentinel of the LRU list or CLOCK ring */
+  PcachePage* hand_;             /* CLOCK hand; &list_ when the ring is empty */
+  PcachePage* free_;             /* arena, hugepage: slots to reuse */
+  PcacheSlab* slabs_;
+  char* slab_next_;
+  char* slab_end_;
+} Pcache;
+
+static int kind_;
+static bool hugetlb_;
+
+/*
+ * Fetches that found the page, fetches that had to fill a slot, and pages
+ * dropped to make room, charged to the benchmark thread whose connection
+ * did the fetch
+ */
+static __thread int64_t hits_;
+static __thread int64_t misses_;
+static __thread int64_t evictions_;
+
+/* Bytes of page memory held by all caches, and the most ever held */
+static int64_t footprint_;
+static int64_t peak_footprint_;
+
+static void footprint_add(int64_t bytes) {
+  int64_t now = __atomic_add_fetch(&footprint_, bytes, __ATOMIC_RELAXED);
+  int64_t peak = __atomic_load_n(&peak_footprint_, __ATOMIC_RELAXED);
+  while (now > peak &&
+         !__atomic_compare_exchange_n(&peak_footprint_, &peak, now, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void list_unlink(PcachePage* page) {
+  page->prev_->next_ = page->next_;
+  page->next_->prev_ = page->prev_;
+}
+
+/* Insert before pos: at the tail when pos is the sentinel */
+static void list_insert_before(PcachePage* pos, PcachePage* page) {
+  page->prev_ = pos->prev_;
+  page->next_ = pos;
+  pos->prev_->next_ = page;
+  pos->prev_ = page;
+}
+
+static PcachePage** hash_slot(Pcache* cache, unsigned key) {
+  return &cache->hash_[key & (cache->buckets_ - 1)];
+}
+
+static PcachePage* hash_find(Pcache* cache, unsigned key) {
+  PcachePage* page = *hash_slot(cache, key);
+  while (page != NULL && page->key_ != key) page = page->hash_next_;
+  return page;
+}
+
+static void hash_remove(Pcache* cache, PcachePage* page) {
+  PcachePage** pp = hash_slot(cache, page->key_);
+  while (*pp != page) pp = &(*pp)->hash_next_;
+  *pp = page->hash_next_;
+}
+
+static void hash_insert(Pcache* cache, PcachePage* page) {
+  if (cache->count_ >= cache->buckets_) {
+    unsigned buckets = cache->buckets_ * 2;
+    PcachePage** hash = calloc(buckets, sizeof(PcachePage*));
+    if (hash != NULL) {
+      for (unsigned i = 0; i < cache->buckets_; i++) {
+        PcachePage* p = cache->hash_[i];
+        while (p != NULL) {
+          PcachePage* next = p->hash_next_;
+          p->hash_next_ = hash[p->key_ & (buckets - 1)];
+          hash[p->key_ & (buckets - 1)] = p;
+          p = next;
+        }
+      }
+      free(cache->hash_);
+      cache->hash_ = hash;
+      cache->buckets_ = buckets;
+    }
+  }
+  PcachePage** slot = hash_slot(cache, page->key_);
+  page->hash_next_ = *slot;
+  *slot = page;
+}
+
+/* Add a slab to an arena or hugepage cache; false if out of memory */
+static bool slab_grow(Pcache* cache) {
+  PcacheSlab* slab = malloc(sizeof(PcacheSlab));
+  if (slab == NULL) return false;
+  slab->mapped_ = false;
+  if (kind_ == PCACHE_HUGEPAGE) {
+    slab->len_ = kHugeSlabBytes;
+    slab->mem_ = NULL;
+    if (hugetlb_) {
+      slab->mem_ = mmap(NULL, slab->len_, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (slab->mem_ == MAP_FAILED) {
+        slab->mem_ = NULL;
+      } else {
+        slab->mapped_ = true;
+      }
+    }
+    if (slab->mem_ == NULL) {
+      void* mem;
+      if (posix_memalign(&mem, kHugeSlabBytes, slab->len_) == 0) {
+        slab->mem_ = mem;
+#ifdef MADV_HUGEPAGE
+        madvise(mem, slab->len_, MADV_HUGEPAGE);
+#endif
+      }
+    }
+  } else {
+    slab->len_ = kArenaSlabBytes;
+    if (slab->len_ < cache->sz_slot_) slab->len_ = cache->sz_slot_;
+    slab->mem_ = malloc(slab->len_);
+  }
+  if (slab->mem_ == NULL) {
+    free(slab);
+    return false;
+  }
+  slab->next_ = cache->slabs_;
+  cache->slabs_ = slab;
+  cache->slab_next_ = slab->mem_;
+  cache->slab_end_ = slab->mem_ + slab->len_;
+  footprint_add(slab->len_);
+  return true;
+}
+
+static PcachePage* slot_alloc(Pcache* cache) {
+  PcachePage* page;
+  if (kind_ == PCACHE_CLOCK) {
+    page = malloc(cache->sz_slot_);
+    if (page == NULL) return NULL;
+    footprint_add(cache->sz_slot_);
+  } else if (cache->free_ != NULL) {
+    page = cache->free_;
+    cache->free_ = page->hash_next_;
+    return page;
+  } else {
+    if (cache->slab_end_ - cache->slab_next_ < (ptrdiff_t)cache->sz_slot_ &&
+        !slab_grow(cache)) {
+      return NULL;
+    }
+    page = (PcachePage*)cache->slab_next_;
+    cache->slab_next_ += cache->sz_slot_;
+  }
+  page->base_.pBuf = &page[1];
+  page->base_.pExtra = (char*)&page[1] + cache->sz_page_;
+  return page;
+}
+
+static void slot_free(Pcache* cache, PcachePage* page) {
+  if (kind_ == PCACHE_CLOCK) {
+    free(page);
+    footprint_add(-(int64_t)cache->sz_slot_);
+  } else {
+    page->hash_next_ = cache->free_;
+    cache->free_ = page;
+  }
+}
+
+/* Take a page out of the cache, leaving its slot to the caller */
+static void page_remove(Pcache* cache, PcachePage* page) {
+  hash_remove(cache, page);
+  cache->count_--;
+  if (page->pinned_) {
+    cache->pinned_--;
+    if (kind_ != PCACHE_CLOCK) return;
+  }
+  if (cache->hand_ == page) {
+    cache->hand_ = page->prev_;
+  }
+  list_unlink(page);
+}
+
+/* Remove an unpinned page by the cache's policy; NULL if all are pinned */
+static PcachePage* evict(Pcache* cache) {
+  PcachePage* page = NULL;
+  if (kind_ == PCACHE_CLOCK) {
+    /* Two turns clear every reference bit, so one turn more is enough */
+    for (unsigned i = 0; i < 2 * cache->count_ + 2; i++) {
+      PcachePage* p = cache->hand_->next_;
+      cache->hand_ = p;
+      if (p == &cache->list_ || p->pinned_) continue;
+      if (p->referenced_) {
+        p->referenced_ = false;
+        continue;
+      }
+      page = p;
+      break;
+    }
+  } else if (cache->list_.next_ != &cache->list_) {
+    page = cache->list_.next_;
+  }
+  if (page != NULL) {
+    page_remove(cache, page);
+    evictions_++;
+  }
+  return page;
+}
+
+/* Evict until no more than n pages remain */
+static void evict_to(Pcache* cache, unsigned n) {
+  while (cache->count_ > n) {
+    PcachePage* page = evict(cache);
+    if (page == NULL) break;
+    slot_free(cache, page);
+  }
+}
+
+static int pcache_global_init(void* arg) {
+  return SQLITE_OK;
+}
+
+static void pcache_global_shutdown(void* arg) {
+}
+
+static sqlite3_pcache* pcache_create(int sz_page, int sz_extra,
+                                     int purgeable) {
+  Pcache* cache = calloc(1, sizeof(Pcache));
+  if (cache == NULL) return NULL;
+  cache->sz_page_ = sz_page;
+  cache->sz_extra_ = sz_extra;
+  cache->sz_slot_ = (sizeof(PcachePage) + sz_page + sz_extra + 7) & ~7;
+  cache->purgeable_ = purgeable;
+  cache->max_ = 100;
+  cache->buckets_ = kInitialBuckets;
+  cache->hash_ = calloc(cache->buckets_, sizeof(PcachePage*));
+  if (cache->hash_ == NULL) {
+    free(cache);
+    return NULL;
+  }
+  cache->list_.prev_ = cache->list_.next_ = &cache->list_;
+  cache->hand_ = &cache->list_;
+  return (sqlite3_pcache*)cache;
+}
+
+static void pcache_cachesize(sqlite3_pcache* p, int n) {
+  Pcache* cache = (Pcache*)p;
+  cache->max_ = n > 0 ? n : 0;
+  if (cache->purgeable_) evict_to(cache, cache->max_);
+}
+
+static int pcache_pagecount(sqlite3_pcache* p) {
+  return ((Pcache*)p)->count_;
+}
+
+static sqlite3_pcache_page* pcache_fetch(sqlite3_pcache* p, unsigned key,
+                                         int create) {
+  Pcache* cache = (Pcache*)p;
+  PcachePage* page = hash_find(cache, key);
+  if (page != NULL) {
+    hits_++;
+    if (!page->pinned_) {
+      if (kind_ != PCACHE_CLOCK) list_unlink(page);
+      page->pinned_ = true;
+      cache->pinned_++;
+    }
+    page->referenced_ = true;
+    return &page->base_;
+  }
+  if (create == 0) return NULL;
+
+  /* As pcache1: with create == 1, fail rather than grow a full cache */
+  bool full = cache->purgeable_ && cache->count_ >= cache->max_;
+  if (create == 1 && cache->purgeable_ &&
+      cache->pinned_ >= cache->max_ - cache->max_ / 10) {
+    return NULL;
+  }
+  if (full) page = evict(cache);
+  if (page == NULL) {
+    if (create == 1 && full) return NULL;
+    page = slot_alloc(cache);
+    if (page == NULL) return NULL;
+  }
+  misses_++;
+  page->key_ = key;
+  page->pinned_ = true;
+  page->referenced_ = true;
+  memset(page->base_.pExtra, 0, cache->sz_extra_);
+  hash_insert(cache, page);
+  cache->count_++;
+  cache->pinned_++;
+  /* The hand moves on before it looks at a page, so the page just before
+   * it is the last one it reaches */
+  if (kind_ == PCACHE_CLOCK) list_insert_before(cache->hand_, page);
+  return &page->base_;
+}
+
+static void pcache_unpin(sqlite3_pcache* p, sqlite3_pcache_page* pg,
+                         int discard) {
+  Pcache* cache = (Pcache*)p;
+  PcachePage* page = (PcachePage*)pg;
+  if (discard) {
+    page_remove(cache, page);
+    slot_free(cache, page);
+    return;
+  }
+  page->pinned_ = false;
+  cache->pinned_--;
+  if (kind_ != PCACHE_CLOCK) list_insert_before(&cache->list_, page);
+  if (cache->purgeable_) evict_to(cache, cache->max_);
+}
+
+static void pcache_rekey(sqlite3_pcache* p, sqlite3_pcache_page* pg,
+                         unsigned old_key, unsigned new_key) {
+  Pcache* cache = (Pcache*)p;
+  PcachePage* page = (PcachePage*)pg;
+  PcachePage* other = hash_find(cache, new_key);
+  if (other != NULL) {
+    page_remove(cache, other);
+    slot_free(cache, other);
+  }
+  hash_remove(cache, page);
+  page->key_ = new_key;
+  /* Not a new page, so the table needs no room */
+  PcachePage** slot = hash_slot(cache, new_key);
+  page->hash_next_ = *slot;
+  *slot = page;
+}
+
+static void pcache_truncate(sqlite3_pcache* p, unsigned limit) {
+  Pcache* cache = (Pcache*)p;
+  for (unsigned i = 0; i < cache->buckets_; i++) {
+    PcachePage* page = cache->hash_[i];
+    while (page != NULL) {
+      PcachePage* next = page->hash_next_;
+      if (page->key_ >= limit) {
+        page_remove(cache, page);
+        slot_free(cache, page);
+      }
+      page = next;
+    }
+  }
+}
+
+static void pcache_destroy(sqlite3_pcache* p) {
+  Pcache* cache = (Pcache*)p;
+  if (kind_ == PCACHE_CLOCK) {
+    pcache_truncate(p, 0);
+  }
+  while (cache->slabs_ != NULL) {
+    PcacheSlab* slab = cache->slabs_;
+    cache->slabs_ = slab->next_;
+    footprint_add(-(int64_t)slab->len_);
+    if (slab->mapped_) {
+      munmap(slab->mem_, slab->len_);
+    } else {
+      free(slab->mem_);
+    }
+    free(slab);
+  }
+  free(cache->hash_);
+  free(cache);
+}
+
+static void pcache_shrink(sqlite3_pcache* p) {
+  Pcache* cache = (Pcache*)p;
+  if (cache->purgeable_) evict_to(cache, 0);
+}
+
+/*
+ * Install the --pcache implementation.  SQLITE_CONFIG_PCACHE2 is refused
+ * once SQLite is initialized, and registering a VFS initializes it, so this
+ * runs before any VFS is set up.
+ */
+void pcache_init(const char* name) {
+  if (!strcmp(name, "arena")) {
+    kind_ = PCACHE_ARENA;
+  } else if (!strcmp(name, "clock")) {
+    kind_ = PCACHE_CLOCK;
+  } else {
+    kind_ = PCACHE_HUGEPAGE;
+    void* probe = mmap(NULL, kHugeSlabBytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    hugetlb_ = MAP_HUGETLB != 0 && probe != MAP_FAILED;
+    if (probe != MAP_FAILED) munmap(probe, kHugeSlabBytes);
+  }
+
+  static const sqlite3_pcache_methods2 methods = {
+    1, NULL, pcache_global_init, pcache_global_shutdown, pcache_create,
+    pcache_cachesize, pcache_pagecount, pcache_fetch, pcache_unpin,
+    pcache_rekey, pcache_truncate, pcache_destroy, pcache_shrink
+  };
+  if (sqlite3_config(SQLITE_CONFIG_PCACHE2, &methods) != SQLITE_OK) {
+    fprintf(stderr, "failed to install the %s page cache\n", name);
+    exit(1);
+  }
+}
+
+/* For the header: where --pcache=hugepage gets its memory */
+const char* pcache_hugepage_source() {
+  return hugetlb_ ? "MAP_HUGETLB" : "transparent huge pages";
+}
+
+/* Hits, misses and evictions of caches used by the calling thread */
+void pcache_counts(int64_t* hits, int64_t* misses, int64_t* evictions) {
+  *hits = hits_;
+  *misses = misses_;
+  *evictions = evictions_;
+}
+
+/* Bytes of page memory now held by all caches; the peak through *peak */
+int64_t pcache_footprint(int64_t* peak) {
+  *peak = __atomic_load_n(&peak_footprint_, __ATOMIC_RELAXED);
+  return __atomic_load_n(&footprint_, __ATOMIC_RELAXED);
+}
+
+/* Start the peak over from the current footprint, for a new benchmark */
+void pcache_reset_peak() {
+  __atomic_store_n(&peak_footprint_,
+                   __atomic_load_n(&footprint_, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+}
@@ -6,6 +6,12 @@
 
 static char *random_string(Random*, int);
 static char *compressible_string(Random*, double, size_t);
+static double zeta(int, double);
+static int zipfian_next(KeyGenerator*, Random*);
+
+static const char* key_dist_names[] = {
+  "uniform", "zipfian", "scrambled_zipfian", "hotspot", "latest", NULL
+};
 
 /*
  * https://github.com/google/leveldb/blob/master/util/testutil.cc
@@ -66,6 +72,125 @@ uint32_t rand_next(Random* rand_) {
 
 uint32_t rand_uniform(Random* rand_, int n) { return rand_next(rand_) % n; }
 
+/* Uniformly distributed in (0, 1) */
+double rand_double(Random* rand_) {
+  return rand_next(rand_) / 2147483647.0;
+}
+
+/*
+ * Generalized harmonic number sum_{i=1}^{n} 1/i^theta.  Past the first
+ * terms the tail is approximated by Euler-Maclaurin summation so that
+ * key generators for large key spaces can be set up in constant time.
+ */
+static double zeta(int n, double theta) {
+  const int kExactTerms = 1000;
+  double sum = 0;
+  int exact = n < kExactTerms ? n : kExactTerms;
+  for (int i = 1; i <= exact; i++) {
+    sum += 1.0 / pow(i, theta);
+  }
+  if (n > kExactTerms) {
+    double a = kExactTerms, b = n;
+    sum += (pow(b, 1 - theta) - pow(a, 1 - theta)) / (1 - theta);
+    sum += (pow(b, -theta) - pow(a, -theta)) / 2;
+    sum += theta * (pow(a, -theta - 1) - pow(b, -theta - 1)) / 12;
+  }
+  return sum;
+}
+
+/*
+ * Zipfian rank in [0, items_), 0 being the most popular.
+ * Jim Gray et al., "Quickly Generating Billion-Record Synthetic
+ * Databases", SIGMOD 1994, as used by YCSB's ZipfianGenerator.
+ */
+static int zipfian_next(KeyGenerator* gen_, Random* rand_) {
+  double u = rand_double(rand_);
+  double uz = u * gen_->zetan_;
+  if (uz < 1.0) return 0;
+  if (uz < 1.0 + pow(0.5, gen_->theta_)) return 1;
+  int k = (int)(gen_->items_ *
+                pow(gen_->eta_ * u - gen_->eta_ + 1, gen_->alpha_));
+  return k < gen_->items_ ? k : gen_->items_ - 1;
+}
+
+int key_dist_from_string(const char* name) {
+  for (int i = 0; key_dist_names[i] != NULL; i++) {
+    if (!strcmp(name, key_dist_names[i])) return i;
+  }
+  return -1;
+}
+
+const char* key_dist_to_string(int dist) {
+  return key_dist_names[dist];
+}
+
+void key_gen_init(KeyGenerator* gen_, int dist, int items, double theta,
+                  double hot_ops_fraction, double hot_keys_fraction) {
+  gen_->dist_ = dist;
+  gen_->theta_ = theta;
+  gen_->hot_ops_fraction_ = hot_ops_fraction;
+  gen_->hot_keys_fraction_ = hot_keys_fraction;
+  gen_->zetan_ = 0;
+  gen_->items_ = 0;
+  key_gen_resize(gen_, items > 0 ? items : 1);
+}
+
+/* Grow the key space to [0, items), e.g. after inserts */
+void key_gen_resize(KeyGenerator* gen_, int items) {
+  if (items <= gen_->items_) return;
+
+  gen_->hot_items_ = (int)(items * gen_->hot_keys_fraction_);
+  if (gen_->hot_items_ < 1) gen_->hot_items_ = 1;
+  if (gen_->hot_items_ > items) gen_->hot_items_ = items;
+
+  int dist = gen_->dist_;
+  if (dist == ZIPFIAN || dist == SCRAMBLED_ZIPFIAN || dist == LATEST) {
+    double theta = gen_->theta_;
+    if (gen_->items_ > 0 && items - gen_->items_ < 1000) {
+      /* A few more keys: extend the sum incrementally */
+      for (int i = gen_->items_ + 1; i <= items; i++) {
+        gen_->zetan_ += 1.0 / pow(i, theta);
+      }
+    } else {
+      gen_->zetan_ = zeta(items, theta);
+    }
+    gen_->alpha_ = 1.0 / (1.0 - theta);
+    gen_->eta_ = (1 - pow(2.0 / items, 1 - theta)) /
+                 (1 - zeta(2, theta) / gen_->zetan_);
+  }
+  gen_->items_ = items;
+}
+
+int key_gen_next(KeyGenerator* gen_, Random* rand_) {
+  switch (gen_->dist_) {
+    case ZIPFIAN:
+      return zipfian_next(gen_, rand_);
+    case SCRAMBLED_ZIPFIAN: {
+      /* Spread the popular keys over the key space with FNV-1a */
+      uint64_t h = 14695981039346656037ULL;
+      uint64_t rank = zipfian_next(gen_, rand_);
+      for (int i = 0; i < 8; i++) {
+        h ^= (rank >> (i * 8)) & 0xff;
+        h *= 1099511628211ULL;
+      }
+      return (int)(h % gen_->items_);
+    }
+    case HOTSPOT:
+      if (rand_double(rand_) < gen_->hot_ops_fraction_ ||
+          gen_->hot_items_ == gen_->items_) {
+        return rand_next(rand_) % gen_->hot_items_;
+      }
+      return gen_->hot_items_ +
+             rand_next(rand_) % (gen_->items_ - gen_->hot_items_);
+    case LATEST:
+      /* Most recently written keys are the most popular */
+      return gen_->items_ - 1 - zipfian_next(gen_, rand_);
+    case UNIFORM:
+    default:
+      return rand_next(rand_) % gen_->items_;
+  }
+}
+
 void rand_gen_init(RandomGenerator* gen_, double compression_ratio) {
   Random rnd;
   char* piece;
@@ -80,19 +205,18 @@ void rand_gen_init(RandomGenerator* gen_, double compression_ratio) {
     piece = compressible_string(&rnd, compression_ratio, 100);
     strcat(gen_->data_, piece);
     gen_->data_size_ += strlen(piece);
+    free(piece);
   }
-
-  free(piece);
 }
 
-char* rand_gen_generate(RandomGenerator* gen_, int len) {
+/* Returns a view of the next len bytes of the corpus, which is shared and
+ * must not be modified.  The view is not NUL-terminated. */
+const char* rand_gen_generate(RandomGenerator* gen_, int len) {
   if (gen_->pos_ + len > gen_->data_size_) {
     gen_->pos_ = 0;
     assert(len < gen_->data_size_);
   }
   gen_->pos_ += len;
-  char* substr = malloc(sizeof(char) * (len + 1));
-  strncpy(substr, (gen_->data_) + gen_->pos_ - len, len);
 
-  return substr;
+  return gen_->data_ + gen_->pos_ - len;
 }
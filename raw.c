@@ -6,34 +6,149 @@
 
 static void raw_calloc(Raw *raw_) {
   raw_->data_size_ = kNumData;
-  raw_->data_ = calloc(sizeof(double), raw_->data_size_);
+  if (FLAGS_raw_sample > 0 && FLAGS_raw_sample < kNumData)
+    raw_->data_size_ = FLAGS_raw_sample;
+  raw_->data_ = bench_calloc(sizeof(double), raw_->data_size_);
   raw_->pos_ = 0;
 }
 
-static void raw_realloc(Raw *raw_) {
-  raw_->data_size_ *= 2;
-  raw_->data_ = realloc(raw_->data_, sizeof(double) * raw_->data_size_);
-  if (!raw_->data_) {
+static void raw_realloc(double **data, size_t *size) {
+  *size = (*size == 0) ? 1024 : *size * 2;
+  *data = bench_realloc(*data, sizeof(double) * *size);
+  if (!*data) {
     fprintf(stderr, "realloc failed\n");
     exit(1);
   }
 }
 
-void raw_clear(Raw *raw_) {
-  if (raw_->data_)
-    free(raw_->data_);
-  raw_calloc(raw_);
+static bool raw_sampling() {
+  return FLAGS_raw_sample > 0;
 }
 
-void raw_add(Raw *raw_, double value) {
+/* Random index in [0, n) for n beyond the range of one rand_next() */
+static int64_t raw_random(Raw *raw_, int64_t n) {
+  uint64_t r = ((uint64_t)rand_next(&raw_->rand_) << 31) ^
+               rand_next(&raw_->rand_);
+  return (int64_t)(r % (uint64_t)n);
+}
+
+static void raw_append(Raw *raw_, double value) {
   if (!raw_->data_)
     raw_calloc(raw_);
   if (raw_->data_size_ < raw_->pos_ + 1)
-    raw_realloc(raw_);
+    raw_realloc(&raw_->data_, &raw_->data_size_);
   raw_->data_[raw_->pos_] = value;
   raw_->pos_++;
 }
 
+static void raw_append_tail(Raw *raw_, double value) {
+  if (raw_->tail_size_ < raw_->tail_pos_ + 1)
+    raw_realloc(&raw_->tail_, &raw_->tail_size_);
+  raw_->tail_[raw_->tail_pos_] = value;
+  raw_->tail_pos_++;
+}
+
+/*
+ * Empty raw_ for reuse; its storage is kept, or allocated on first add.
+ * seed starts the reservoir's generator, so threads given different seeds
+ * keep independent samples.
+ */
+void raw_clear(Raw *raw_, uint32_t seed) {
+  raw_->pos_ = 0;
+  raw_->seen_ = 0;
+  raw_->tail_pos_ = 0;
+  rand_init(&raw_->rand_, seed);
+}
+
+/*
+ * With --raw_sample=K, samples below --raw_threshold are kept as a uniform
+ * reservoir of K (Vitter's algorithm R) and samples at or above it are all
+ * kept in the tail.  Otherwise every sample is kept.
+ */
+void raw_add(Raw *raw_, double value) {
+  if (!raw_sampling()) {
+    raw_append(raw_, value);
+  } else if (FLAGS_raw_threshold > 0 && value >= FLAGS_raw_threshold) {
+    raw_append_tail(raw_, value);
+  } else {
+    raw_->seen_++;
+    if (raw_->pos_ < FLAGS_raw_sample) {
+      raw_append(raw_, value);
+    } else {
+      int64_t j = raw_random(raw_, raw_->seen_);
+      if (j < FLAGS_raw_sample) raw_->data_[j] = value;
+    }
+  }
+}
+
+/*
+ * Merge two reservoirs into one of at most K samples.  Each pick comes from
+ * a reservoir in proportion to the samples it still stands for, so the
+ * result is a uniform sample of both streams together.
+ */
+static void raw_merge_sampled(Raw *raw_, const Raw *other_) {
+  /* An unseeded generator only ever returns 0 and so always picks from
+   * the first reservoir; raw_clear() seeds it */
+  assert(raw_->rand_.seed_ != 0);
+  int n = raw_->pos_ + other_->pos_;
+  if (n <= FLAGS_raw_sample) {
+    for (int i = 0; i < other_->pos_; i++)
+      raw_append(raw_, other_->data_[i]);
+    raw_->seen_ += other_->seen_;
+    return;
+  }
+
+  double* pool = malloc(sizeof(double) * n);
+  if (raw_->pos_ > 0)
+    memcpy(pool, raw_->data_, sizeof(double) * raw_->pos_);
+  memcpy(pool + raw_->pos_, other_->data_, sizeof(double) * other_->pos_);
+  int left[2] = { raw_->pos_, other_->pos_ };
+  int base[2] = { 0, raw_->pos_ };
+  double weight[2] = {
+    raw_->pos_ ? (double)raw_->seen_ / raw_->pos_ : 0,
+    other_->pos_ ? (double)other_->seen_ / other_->pos_ : 0
+  };
+
+  raw_->pos_ = 0;
+  while (raw_->pos_ < FLAGS_raw_sample) {
+    double w0 = left[0] * weight[0];
+    double w1 = left[1] * weight[1];
+    int s = (rand_double(&raw_->rand_) * (w0 + w1) < w0) ? 0 : 1;
+    if (left[s] == 0) s = 1 - s;
+    /* Take a random remaining sample of reservoir s */
+    int j = base[s] + (int)raw_random(raw_, left[s]);
+    raw_append(raw_, pool[j]);
+    pool[j] = pool[base[s] + left[s] - 1];
+    left[s]--;
+  }
+  raw_->seen_ += other_->seen_;
+  free(pool);
+}
+
+void raw_merge(Raw *raw_, const Raw *other_) {
+  if (raw_sampling()) {
+    raw_merge_sampled(raw_, other_);
+    for (int i = 0; i < other_->tail_pos_; i++)
+      raw_append_tail(raw_, other_->tail_[i]);
+    return;
+  }
+  for (int i = 0; i < other_->pos_; i++)
+    raw_add(raw_, other_->data_[i]);
+}
+
+void raw_free(Raw *raw_) {
+  if (raw_->data_)
+    free(raw_->data_);
+  if (raw_->tail_)
+    free(raw_->tail_);
+  raw_->data_ = NULL;
+  raw_->data_size_ = 0;
+  raw_->pos_ = 0;
+  raw_->tail_ = NULL;
+  raw_->tail_size_ = 0;
+  raw_->tail_pos_ = 0;
+}
+
 char* raw_to_string(Raw *raw_) {
   if (!raw_->data_)
     raw_calloc(raw_);
@@ -41,8 +156,9 @@ char* raw_to_string(Raw *raw_) {
   char *r = malloc(sizeof(char) * r_size);
   strcpy(r, "");
   char buf[200];
-  for (int i = 0; i < raw_->pos_; i++) {
-    snprintf(buf, sizeof(buf), "%.4f\n", raw_->data_[i]);
+  for (int i = 0; i < raw_->pos_ + raw_->tail_pos_; i++) {
+    snprintf(buf, sizeof(buf), "%.4f\n", (i < raw_->pos_) ?
+             raw_->data_[i] : raw_->tail_[i - raw_->pos_]);
     if (r_size < strlen(r) + strlen(buf)) {
       r = realloc(r, r_size * 2);
       r_size *= 2;
@@ -55,7 +171,17 @@ char* raw_to_string(Raw *raw_) {
 void raw_print(FILE *stream, Raw *raw_) {
   if (!raw_->data_)
     raw_calloc(raw_);
-  fprintf(stream, "num,time\n");
+  if (!raw_sampling()) {
+    fprintf(stream, "num,time\n");
+    for (int i = 0; i < raw_->pos_; i++)
+      fprintf(stream, "%d,%.4f\n", i, raw_->data_[i]);
+    return;
+  }
+  /* Reservoir samples stand for seen_ / pos_ ops each, tail samples one */
+  fprintf(stream, "num,time,stratum,weight\n");
+  double weight = raw_->pos_ ? (double)raw_->seen_ / raw_->pos_ : 0;
   for (int i = 0; i < raw_->pos_; i++)
-    fprintf(stream, "%d,%.4f\n", i, raw_->data_[i]);
+    fprintf(stream, "%d,%.4f,sample,%.4f\n", i, raw_->data_[i], weight);
+  for (int i = 0; i < raw_->tail_pos_; i++)
+    fprintf(stream, "%d,%.4f,tail,1\n", raw_->pos_ + i, raw_->tail_[i]);
 }
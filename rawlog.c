@@ -0,0 +1,151 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * Streaming binary log of per-op latencies (--raw_file).  Each thread
+ * fills its own fixed-size buffer and appends it to the file when full, so
+ * memory use does not grow with the number of ops.
+ *
+ * The file starts with kRawLogMagic, followed by tagged records in host
+ * byte order:
+ *   'B' u16 length, name           start of a benchmark
+ *   'R' u16 thread, u8 op type, i32 key, u64 time, u64 latency
+ * Times are nanoseconds since the log was opened, latencies nanoseconds.
+ */
+
+#define kRawLogMagic "SQLBRAW1"
+#define kRawLogBufferSize 65536
+#define kRawLogRecordSize 24
+
+static FILE* raw_log_file_ = NULL;
+static uint64_t raw_log_epoch_;
+
+bool raw_log_enabled() {
+  return raw_log_file_ != NULL;
+}
+
+void raw_log_open(const char* path) {
+  raw_log_file_ = fopen(path, "wb");
+  if (raw_log_file_ == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    exit(1);
+  }
+  /* Threads write whole buffers; no need for a second copy in stdio */
+  setvbuf(raw_log_file_, NULL, _IONBF, 0);
+  fwrite(kRawLogMagic, 1, strlen(kRawLogMagic), raw_log_file_);
+  raw_log_epoch_ = now_nanos();
+}
+
+void raw_log_close() {
+  if (raw_log_file_ == NULL) return;
+  fclose(raw_log_file_);
+  raw_log_file_ = NULL;
+}
+
+/* Mark the start of a benchmark; all thread buffers must be flushed */
+void raw_log_benchmark(const char* name) {
+  char buf[3 + 256];
+  uint16_t len = (uint16_t)strnlen(name, 256);
+  buf[0] = 'B';
+  memcpy(buf + 1, &len, sizeof(len));
+  memcpy(buf + 3, name, len);
+  fwrite(buf, 1, 3 + len, raw_log_file_);
+}
+
+void raw_log_flush(RawLog* log) {
+  if (log->pos_ == 0) return;
+  if (fwrite(log->buf_, 1, log->pos_, raw_log_file_) != log->pos_) {
+    fprintf(stderr, "raw log write failed\n");
+    exit(1);
+  }
+  log->pos_ = 0;
+}
+
+void raw_log_add(RawLog* log, int thread, int op_type, int key,
+                 uint64_t time, uint64_t latency) {
+  if (log->buf_ == NULL) {
+    log->buf_ = bench_malloc(kRawLogBufferSize);
+    log->pos_ = 0;
+  }
+  if (log->pos_ + kRawLogRecordSize > kRawLogBufferSize) {
+    raw_log_flush(log);
+  }
+  char* p = log->buf_ + log->pos_;
+  uint16_t tid = (uint16_t)thread;
+  uint8_t op = (uint8_t)op_type;
+  int32_t k = key;
+  time -= raw_log_epoch_;
+  p[0] = 'R';
+  memcpy(p + 1, &tid, 2);
+  memcpy(p + 3, &op, 1);
+  memcpy(p + 4, &k, 4);
+  memcpy(p + 8, &time, 8);
+  memcpy(p + 16, &latency, 8);
+  log->pos_ += kRawLogRecordSize;
+}
+
+void raw_log_free(RawLog* log) {
+  if (log->buf_)
+    free(log->buf_);
+  log->buf_ = NULL;
+  log->pos_ = 0;
+}
+
+/* Write a --raw_file log as CSV to out; returns false on a bad file */
+bool raw_log_decode(const char* path, FILE* out, const char** op_names) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  char magic[8];
+  if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+      memcmp(magic, kRawLogMagic, sizeof(magic))) {
+    fprintf(stderr, "%s is not a raw log\n", path);
+    fclose(f);
+    return false;
+  }
+
+  char name[257] = "";
+  char rec[kRawLogRecordSize];
+  bool ok = true;
+  int tag;
+  fprintf(out, "benchmark,thread,op,key,time_ns,latency_ns\n");
+  while ((tag = fgetc(f)) != EOF) {
+    if (tag == 'B') {
+      uint16_t len;
+      if (fread(&len, 2, 1, f) != 1 || len > 256 ||
+          fread(name, 1, len, f) != len) {
+        ok = false;
+        break;
+      }
+      name[len] = '\0';
+    } else if (tag == 'R') {
+      if (fread(rec + 1, 1, kRawLogRecordSize - 1, f) !=
+          kRawLogRecordSize - 1) {
+        ok = false;
+        break;
+      }
+      uint16_t tid;
+      uint8_t op;
+      int32_t key;
+      uint64_t time, latency;
+      memcpy(&tid, rec + 1, 2);
+      memcpy(&op, rec + 3, 1);
+      memcpy(&key, rec + 4, 4);
+      memcpy(&time, rec + 8, 8);
+      memcpy(&latency, rec + 16, 8);
+      fprintf(out, "%s,%u,%s,%d,%" PRIu64 ",%" PRIu64 "\n", name, tid,
+              op < kNumOpTypes ? op_names[op] : "?", key, time, latency);
+    } else {
+      ok = false;
+      break;
+    }
+  }
+  if (!ok) fprintf(stderr, "%s is truncated or corrupt\n", path);
+  fclose(f);
+  return ok;
+}
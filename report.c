@@ -0,0 +1,176 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * Streaming writer for the --report=json:PATH document.  Objects and
+ * arrays are opened and closed explicitly; the writer keeps track of the
+ * separators between members.
+ */
+
+#define kMaxReportDepth 16
+
+static FILE* report_file_ = NULL;
+static int report_depth_ = 0;
+static bool report_need_comma_[kMaxReportDepth];
+static char report_closer_[kMaxReportDepth];
+
+bool report_enabled() {
+  return report_file_ != NULL;
+}
+
+static void report_indent() {
+  fprintf(report_file_, "\n");
+  for (int i = 0; i < report_depth_; i++) {
+    fprintf(report_file_, "  ");
+  }
+}
+
+static void report_escaped(const char* s) {
+  fputc('"', report_file_);
+  for (; *s != '\0'; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') {
+      fprintf(report_file_, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(report_file_, "\\u%04x", c);
+    } else {
+      fputc(c, report_file_);
+    }
+  }
+  fputc('"', report_file_);
+}
+
+/* Separator, indentation and key of the next member */
+static void report_member(const char* key) {
+  if (report_need_comma_[report_depth_]) fputc(',', report_file_);
+  report_need_comma_[report_depth_] = true;
+  report_indent();
+  if (key != NULL) {
+    report_escaped(key);
+    fprintf(report_file_, ": ");
+  }
+}
+
+static void report_open(const char* key, char bracket) {
+  report_member(key);
+  fputc(bracket, report_file_);
+  assert(report_depth_ + 1 < kMaxReportDepth);
+  report_depth_++;
+  report_need_comma_[report_depth_] = false;
+  report_closer_[report_depth_] = (bracket == '{') ? '}' : ']';
+}
+
+static void report_close(char bracket) {
+  bool empty = !report_need_comma_[report_depth_];
+  assert(report_closer_[report_depth_] == bracket);
+  report_depth_--;
+  if (!empty) report_indent();
+  fputc(bracket, report_file_);
+}
+
+/* Start the document in the file named by a "json:PATH" spec */
+void report_begin(const char* spec) {
+  if (!starts_with(spec, "json:")) {
+    fprintf(stderr, "unsupported report format '%s'\n", spec);
+    exit(1);
+  }
+  report_file_ = fopen(spec + strlen("json:"), "w");
+  if (report_file_ == NULL) {
+    fprintf(stderr, "cannot open %s\n", spec + strlen("json:"));
+    exit(1);
+  }
+  report_depth_ = 0;
+  report_need_comma_[0] = false;
+  fputc('{', report_file_);
+  report_depth_++;
+  report_need_comma_[report_depth_] = false;
+  report_closer_[report_depth_] = '}';
+}
+
+void report_end() {
+  if (!report_enabled()) return;
+  while (report_depth_ > 0) {
+    /* Close whatever is still open, innermost first */
+    report_close(report_closer_[report_depth_]);
+  }
+  fputc('\n', report_file_);
+  fclose(report_file_);
+  report_file_ = NULL;
+}
+
+void report_begin_object(const char* key) {
+  report_open(key, '{');
+}
+
+void report_end_object() {
+  report_close('}');
+}
+
+void report_begin_array(const char* key) {
+  report_open(key, '[');
+}
+
+void report_end_array() {
+  report_close(']');
+}
+
+void report_string(const char* key, const char* value) {
+  report_member(key);
+  if (value == NULL) {
+    fprintf(report_file_, "null");
+  } else {
+    report_escaped(value);
+  }
+}
+
+void report_int(const char* key, int64_t value) {
+  report_member(key);
+  fprintf(report_file_, "%" PRId64, value);
+}
+
+void report_double(const char* key, double value) {
+  report_member(key);
+  if (isfinite(value)) {
+    fprintf(report_file_, "%.17g", value);
+  } else {
+    fprintf(report_file_, "null");
+  }
+}
+
+void report_bool(const char* key, bool value) {
+  report_member(key);
+  fprintf(report_file_, value ? "true" : "false");
+}
+
+/* Summary, percentile spectrum and non-empty slots of a histogram */
+void report_histogram(const char* key, Histogram* hist) {
+  static const double kPercentiles[] = {
+    50, 75, 90, 95, 99, 99.9, 99.99, 99.999
+  };
+  char name[16];
+
+  report_begin_object(key);
+  report_double("count", hist->num_);
+  report_double("min", hist->num_ > 0 ? hist->min_ : 0);
+  report_double("max", hist->max_);
+  report_double("mean", hist->num_ > 0 ? hist->sum_ / hist->num_ : 0);
+  report_int("digits", hist->digits_);
+  report_begin_object("percentiles");
+  for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(double); i++) {
+    snprintf(name, sizeof(name), "%g", kPercentiles[i]);
+    report_double(name, histogram_percentile(hist, kPercentiles[i]));
+  }
+  report_end_object();
+  report_begin_array("buckets");
+  for (int i = 0; hist->counts_ && i < hist->counts_len_; i++) {
+    if (hist->counts_[i] == 0) continue;
+    report_member(NULL);
+    fprintf(report_file_, "[%" PRId64 ", %" PRId64 "]",
+            histogram_bucket_value(hist, i), hist->counts_[i]);
+  }
+  report_end_array();
+  report_end_object();
+}
@@ -0,0 +1,551 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <ctype.h>
+#include <time.h>
+
+/*
+ * Trace files for --replay hold one line per statement execution, with
+ * tab-separated fields:
+ *
+ *   NANOS  CONN  SQL  [VALUE ...]
+ *
+ * NANOS is the CLOCK_REALTIME time the statement started, CONN a number
+ * for the connection that ran it and SQL the statement as prepared, its
+ * parameters left in.  The VALUEs are bound to parameters 1, 2, ... in
+ * turn: N for NULL, I<integer>, F<real>, T<text>, B<hex> for a blob or
+ * Z<length> for a zeroblob.  Tabs, newlines, carriage returns and
+ * backslashes in SQL and T values are written as \t, \n, \r and \\.
+ *
+ * trace_capture() emits this format from any connection through
+ * sqlite3_trace_v2().  It needs nothing but SQLite and the C library, so
+ * an application can take it as it is.  The bound values are read back
+ * from sqlite3_expanded_sql(), which keeps 15 significant digits of a
+ * real; a statement whose expansion fails is recorded with NULL values.
+ */
+
+/* Growable line buffer */
+typedef struct TraceBuf {
+  char* data_;
+  size_t len_;
+  size_t capacity_;
+} TraceBuf;
+
+/* A value as sqlite3_expanded_sql() wrote it */
+typedef struct Literal {
+  const char* text_;
+  size_t len_;
+} Literal;
+
+typedef struct TraceCapture {
+  FILE* out_;
+  int conn_;
+} TraceCapture;
+
+static int capture_conns_;
+/* Set while the thread runs statements that are left out of the trace */
+static __thread bool capture_paused_;
+
+static void buf_append(TraceBuf* buf, const char* s, size_t n) {
+  if (buf->len_ + n + 1 > buf->capacity_) {
+    buf->capacity_ = (buf->len_ + n + 1) * 2;
+    buf->data_ = realloc(buf->data_, buf->capacity_);
+  }
+  memcpy(buf->data_ + buf->len_, s, n);
+  buf->len_ += n;
+  buf->data_[buf->len_] = '\0';
+}
+
+static void buf_append_escaped(TraceBuf* buf, const char* s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    switch (s[i]) {
+      case '\t': buf_append(buf, "\\t", 2); break;
+      case '\n': buf_append(buf, "\\n", 2); break;
+      case '\r': buf_append(buf, "\\r", 2); break;
+      case '\\': buf_append(buf, "\\\\", 2); break;
+      default:   buf_append(buf, &s[i], 1);
+    }
+  }
+}
+
+static bool is_ident_char(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '$' ||
+         (unsigned char)c >= 0x80;
+}
+
+/* Length of the quoted string or name, or comment, starting at s; else 0 */
+static size_t quoted_length(const char* s) {
+  const char* end;
+  char close;
+  switch (s[0]) {
+    case '\'':
+    case '"':
+    case '`':
+      close = s[0];
+      break;
+    case '[':
+      close = ']';
+      break;
+    case '-':
+      if (s[1] != '-') return 0;
+      end = strchr(s, '\n');
+      return end != NULL ? (size_t)(end - s) : strlen(s);
+    case '/':
+      if (s[1] != '*') return 0;
+      end = strstr(s + 2, "*/");
+      return end != NULL ? (size_t)(end + 2 - s) : strlen(s);
+    default:
+      return 0;
+  }
+  size_t i = 1;
+  while (s[i] != '\0') {
+    if (s[i] == close) {
+      /* A doubled quote stands for itself */
+      if (close != ']' && s[i + 1] == close) {
+        i += 2;
+        continue;
+      }
+      return i + 1;
+    }
+    i++;
+  }
+  return i;
+}
+
+/* Length of the literal sqlite3_expanded_sql() wrote at s for a value */
+static size_t literal_length(const char* s) {
+  size_t i = 0;
+  if (!strncmp(s, "NULL", 4)) return 4;
+  if (s[0] == '\'') return quoted_length(s);
+  if ((s[0] == 'x' || s[0] == 'X') && s[1] == '\'') {
+    return 1 + quoted_length(s + 1);
+  }
+  if (!strncmp(s, "zeroblob(", 9)) {
+    const char* end = strchr(s, ')');
+    return end != NULL ? (size_t)(end + 1 - s) : 0;
+  }
+  if (s[i] == '-') i++;
+  while (isalnum((unsigned char)s[i]) || s[i] == '.' ||
+         (i > 0 && (s[i] == '+' || s[i] == '-') &&
+          (s[i - 1] == 'e' || s[i - 1] == 'E'))) {
+    i++;
+  }
+  return i;
+}
+
+/* Index of the parameter at s in stmt, and its length; 0 if none */
+static int parameter_at(sqlite3_stmt* stmt, const char* sql, const char* s,
+                        int last, size_t* len) {
+  char name[256];
+  if (s[0] == '?') {
+    *len = 1;
+    while (isdigit((unsigned char)s[*len])) (*len)++;
+    return *len > 1 ? atoi(s + 1) : last + 1;
+  }
+  if ((s[0] != ':' && s[0] != '@' && s[0] != '$') ||
+      (s > sql && is_ident_char(s[-1])) || !is_ident_char(s[1])) {
+    return 0;
+  }
+  *len = 1;
+  while (is_ident_char(s[*len])) (*len)++;
+  if (*len >= sizeof(name)) return 0;
+  memcpy(name, s, *len);
+  name[*len] = '\0';
+  return sqlite3_bind_parameter_index(stmt, name);
+}
+
+/*
+ * Find the literal sqlite3_expanded_sql() substituted for each parameter
+ * by walking the statement text and its expansion side by side.  Returns
+ * false if the two do not line up.
+ */
+static bool find_literals(sqlite3_stmt* stmt, const char* sql,
+                          const char* expanded, Literal* values, int n) {
+  const char* s = sql;
+  const char* e = expanded;
+  int last = 0;
+  while (*s != '\0') {
+    size_t len = quoted_length(s);
+    if (len > 0) {
+      if (strncmp(s, e, len)) return false;
+      s += len;
+      e += len;
+      continue;
+    }
+    int index = parameter_at(stmt, sql, s, last, &len);
+    if (index > 0) {
+      size_t value_len = literal_length(e);
+      if (index > n || value_len == 0) return false;
+      values[index - 1].text_ = e;
+      values[index - 1].len_ = value_len;
+      if (index > last) last = index;
+      s += len;
+      e += value_len;
+      continue;
+    }
+    if (*s != *e) return false;
+    s++;
+    e++;
+  }
+  return *e == '\0';
+}
+
+/* Append a literal as a trace VALUE field */
+static void append_value(TraceBuf* buf, const Literal* value) {
+  const char* s = value->text_;
+  size_t n = value->len_;
+  if (s == NULL || (n == 4 && !strncmp(s, "NULL", 4))) {
+    buf_append(buf, "N", 1);
+  } else if (s[0] == '\'') {
+    buf_append(buf, "T", 1);
+    for (size_t i = 1; i + 1 < n; i++) {
+      buf_append_escaped(buf, &s[i], 1);
+      if (s[i] == '\'') i++;
+    }
+  } else if (s[0] == 'x' || s[0] == 'X') {
+    buf_append(buf, "B", 1);
+    buf_append(buf, s + 2, n - 3);
+  } else if (s[0] == 'z') {
+    buf_append(buf, "Z", 1);
+    buf_append(buf, s + 9, n - 10);
+  } else {
+    bool real = false;
+    for (size_t i = 0; i < n; i++) {
+      if (!isdigit((unsigned char)s[i]) && s[i] != '-') real = true;
+    }
+    buf_append(buf, real ? "F" : "I", 1);
+    buf_append(buf, s, n);
+  }
+}
+
+static int capture_callback(unsigned type, void* ctx, void* p, void* x) {
+  TraceCapture* capture = ctx;
+  if (type == SQLITE_TRACE_CLOSE) {
+    free(capture);
+    return 0;
+  }
+
+  if (capture_paused_) return 0;
+
+  /* Statements run by triggers come as "--" comments; replaying the
+   * statement that fired them runs them again */
+  sqlite3_stmt* stmt = p;
+  const char* sql = sqlite3_sql(stmt);
+  if (sql == NULL || !strncmp((const char*)x, "--", 2)) return 0;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  int n = sqlite3_bind_parameter_count(stmt);
+  Literal* values = calloc(n + 1, sizeof(Literal));
+  char* expanded = n > 0 ? sqlite3_expanded_sql(stmt) : NULL;
+  if (expanded == NULL || !find_literals(stmt, sql, expanded, values, n)) {
+    memset(values, 0, (n + 1) * sizeof(Literal));
+  }
+
+  TraceBuf buf = { NULL, 0, 0 };
+  char head[64];
+  snprintf(head, sizeof(head), "%lld\t%d\t",
+           (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec, capture->conn_);
+  buf_append(&buf, head, strlen(head));
+  buf_append_escaped(&buf, sql, strlen(sql));
+  for (int i = 0; i < n; i++) {
+    buf_append(&buf, "\t", 1);
+    append_value(&buf, &values[i]);
+  }
+  buf_append(&buf, "\n", 1);
+  /* One write, so that lines of concurrent connections do not mix */
+  fwrite(buf.data_, 1, buf.len_, capture->out_);
+
+  free(buf.data_);
+  sqlite3_free(expanded);
+  free(values);
+  return 0;
+}
+
+/*
+ * Append every statement db runs from now on to out, one line each as
+ * described above.  Returns an SQLite result code.
+ */
+int trace_capture(sqlite3* db, FILE* out) {
+  TraceCapture* capture = malloc(sizeof(TraceCapture));
+  if (capture == NULL) return SQLITE_NOMEM;
+  capture->out_ = out;
+  capture->conn_ = __atomic_add_fetch(&capture_conns_, 1, __ATOMIC_RELAXED);
+  int status = sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_CLOSE,
+                                capture_callback, capture);
+  if (status != SQLITE_OK) free(capture);
+  return status;
+}
+
+/*
+ * Leave what the calling thread runs on any connection out of the trace
+ * until trace_pause(false), such as setup that replaying should not redo.
+ */
+void trace_pause(bool pause) {
+  capture_paused_ = pause;
+}
+
+/* Open-addressing index from strings to their position in an array */
+typedef struct InternTable {
+  int* slots_;
+  int capacity_;
+} InternTable;
+
+static uint32_t hash_string(const char* s) {
+  uint32_t h = 2166136261u;
+  while (*s != '\0') {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Index of s in (*names)[0..*count), appending a copy of it if new */
+static int intern(InternTable* table, char*** names, int* count,
+                  const char* s) {
+  if (*count * 2 >= table->capacity_) {
+    int capacity = table->capacity_ > 0 ? table->capacity_ * 2 : 64;
+    int* slots = malloc(capacity * sizeof(int));
+    for (int i = 0; i < capacity; i++) slots[i] = -1;
+    for (int i = 0; i < *count; i++) {
+      uint32_t h = hash_string((*names)[i]) & (capacity - 1);
+      while (slots[h] >= 0) h = (h + 1) & (capacity - 1);
+      slots[h] = i;
+    }
+    free(table->slots_);
+    table->slots_ = slots;
+    table->capacity_ = capacity;
+    *names = realloc(*names, capacity / 2 * sizeof(char*));
+  }
+  uint32_t h = hash_string(s) & (table->capacity_ - 1);
+  while (table->slots_[h] >= 0) {
+    if (!strcmp((*names)[table->slots_[h]], s)) return table->slots_[h];
+    h = (h + 1) & (table->capacity_ - 1);
+  }
+  table->slots_[h] = *count;
+  (*names)[*count] = strdup(s);
+  return (*count)++;
+}
+
+/*
+ * The statement with its literals and parameters replaced by ? and its
+ * comments and runs of white space by one space, so that executions
+ * differing only in their values share a fingerprint.
+ */
+static char* fingerprint(const char* sql) {
+  TraceBuf buf = { NULL, 0, 0 };
+  const char* s = sql;
+  size_t len;
+  while (*s != '\0') {
+    bool word_start = (s == sql || !is_ident_char(s[-1]));
+    if (isspace((unsigned char)*s) || !strncmp(s, "--", 2) ||
+        !strncmp(s, "/*", 2)) {
+      while (isspace((unsigned char)*s) || !strncmp(s, "--", 2) ||
+             !strncmp(s, "/*", 2)) {
+        s += isspace((unsigned char)*s) ? 1 : quoted_length(s);
+      }
+      if (buf.len_ > 0 && *s != '\0') buf_append(&buf, " ", 1);
+    } else if (*s == '\'' || (word_start && (*s == 'x' || *s == 'X') &&
+                              s[1] == '\'')) {
+      s += (*s == '\'') ? quoted_length(s) : 1 + quoted_length(s + 1);
+      buf_append(&buf, "?", 1);
+    } else if ((len = quoted_length(s)) > 0) {
+      buf_append(&buf, s, len);
+      s += len;
+    } else if (word_start && (isdigit((unsigned char)*s) ||
+                              (*s == '.' && isdigit((unsigned char)s[1])))) {
+      while (isalnum((unsigned char)*s) || *s == '.') s++;
+      buf_append(&buf, "?", 1);
+    } else if (*s == '?' || (word_start && (*s == ':' || *s == '@' ||
+                                            *s == '$') && is_ident_char(s[1]))) {
+      s++;
+      while (is_ident_char(*s)) s++;
+      buf_append(&buf, "?", 1);
+    } else {
+      buf_append(&buf, s, 1);
+      s++;
+    }
+  }
+  return buf.data_ != NULL ? buf.data_ : strdup("");
+}
+
+/* Undo the escaping of a SQL or T field in place */
+static void unescape(char* s) {
+  char* out = s;
+  for (; *s != '\0'; s++) {
+    if (*s == '\\' && s[1] != '\0') {
+      s++;
+      *out++ = *s == 't' ? '\t' : *s == 'n' ? '\n' : *s == 'r' ? '\r' : *s;
+    } else {
+      *out++ = *s;
+    }
+  }
+  *out = '\0';
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool parse_param(TraceParam* param, char* text) {
+  char junk;
+  memset(param, 0, sizeof(*param));
+  param->type_ = text[0];
+  switch (text[0]) {
+    case 'N':
+      return text[1] == '\0';
+    case 'I':
+      return sscanf(text + 1, "%" SCNd64 "%c", &param->int_, &junk) == 1;
+    case 'Z':
+      return sscanf(text + 1, "%" SCNd64 "%c", &param->int_, &junk) == 1 &&
+             param->int_ >= 0 && param->int_ <= INT32_MAX;
+    case 'F':
+      return sscanf(text + 1, "%lf%c", &param->real_, &junk) == 1;
+    case 'T':
+      unescape(text + 1);
+      param->data_ = strdup(text + 1);
+      param->len_ = strlen(param->data_);
+      return true;
+    case 'B': {
+      size_t n = strlen(text + 1);
+      if (n % 2 != 0) return false;
+      param->data_ = malloc(n / 2 + 1);
+      param->len_ = n / 2;
+      for (size_t i = 0; i < n / 2; i++) {
+        int hi = hex_digit(text[1 + 2 * i]);
+        int lo = hex_digit(text[2 + 2 * i]);
+        if (hi < 0 || lo < 0) return false;
+        param->data_[i] = (char)(hi << 4 | lo);
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+static TraceStream* find_stream(Trace* trace, int conn) {
+  for (int i = trace->num_streams_ - 1; i >= 0; i--) {
+    if (trace->streams_[i].conn_ == conn) return &trace->streams_[i];
+  }
+  trace->streams_ = realloc(trace->streams_,
+                            sizeof(TraceStream) * (trace->num_streams_ + 1));
+  TraceStream* stream = &trace->streams_[trace->num_streams_++];
+  memset(stream, 0, sizeof(*stream));
+  stream->conn_ = conn;
+  return stream;
+}
+
+static void trace_error(const char* path, int64_t line, const char* msg) {
+  fprintf(stderr, "%s:%" PRId64 ": %s\n", path, line, msg);
+  exit(1);
+}
+
+/* Read a trace file; exits with a message on any error */
+void trace_load(Trace* trace, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    exit(1);
+  }
+  memset(trace, 0, sizeof(*trace));
+  trace->start_nanos_ = INT64_MAX;
+  InternTable sql_table = { NULL, 0 };
+  InternTable fingerprint_table = { NULL, 0 };
+  int sql_capacity = 0;
+  char* line = NULL;
+  size_t line_size = 0;
+  int64_t line_num = 0;
+  ssize_t len;
+  while ((len = getline(&line, &line_size, f)) >= 0) {
+    line_num++;
+    if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+    if (len == 0) continue;
+
+    char* save = NULL;
+    char* nanos = strtok_r(line, "\t", &save);
+    char* conn = strtok_r(NULL, "\t", &save);
+    char* sql = strtok_r(NULL, "\t", &save);
+    int64_t when;
+    int conn_id;
+    char junk;
+    if (sql == NULL ||
+        sscanf(nanos, "%" SCNd64 "%c", &when, &junk) != 1 ||
+        sscanf(conn, "%d%c", &conn_id, &junk) != 1) {
+      trace_error(path, line_num, "expected NANOS, CONN and SQL");
+    }
+
+    TraceStream* stream = find_stream(trace, conn_id);
+    if (stream->num_records_ == stream->capacity_) {
+      stream->capacity_ = stream->capacity_ > 0 ? stream->capacity_ * 2 : 64;
+      stream->records_ = realloc(stream->records_,
+                                 sizeof(TraceRecord) * stream->capacity_);
+    }
+    TraceRecord* record = &stream->records_[stream->num_records_++];
+    record->nanos_ = when;
+    if (when < trace->start_nanos_) trace->start_nanos_ = when;
+
+    unescape(sql);
+    record->sql_ = intern(&sql_table, &trace->sql_, &trace->num_sql_, sql);
+    if (trace->num_sql_ > sql_capacity) {
+      sql_capacity = trace->num_sql_ * 2;
+      trace->fingerprint_of_ = realloc(trace->fingerprint_of_,
+                                       sizeof(int) * sql_capacity);
+    }
+    if (record->sql_ == trace->num_sql_ - 1) {
+      char* fp = fingerprint(sql);
+      trace->fingerprint_of_[record->sql_] =
+        intern(&fingerprint_table, &trace->fingerprints_,
+               &trace->num_fingerprints_, fp);
+      free(fp);
+    }
+
+    record->num_params_ = 0;
+    record->params_ = NULL;
+    for (char* value = strtok_r(NULL, "\t", &save); value != NULL;
+         value = strtok_r(NULL, "\t", &save)) {
+      record->params_ = realloc(record->params_,
+                                sizeof(TraceParam) * (record->num_params_ + 1));
+      if (!parse_param(&record->params_[record->num_params_++], value)) {
+        trace_error(path, line_num, "bad value");
+      }
+    }
+    trace->num_records_++;
+  }
+  free(line);
+  free(sql_table.slots_);
+  free(fingerprint_table.slots_);
+  fclose(f);
+  if (trace->num_records_ == 0) {
+    fprintf(stderr, "%s has no statements\n", path);
+    exit(1);
+  }
+}
+
+void trace_free(Trace* trace) {
+  for (int i = 0; i < trace->num_streams_; i++) {
+    TraceStream* stream = &trace->streams_[i];
+    for (int j = 0; j < stream->num_records_; j++) {
+      for (int k = 0; k < stream->records_[j].num_params_; k++) {
+        free(stream->records_[j].params_[k].data_);
+      }
+      free(stream->records_[j].params_);
+    }
+    free(stream->records_);
+  }
+  for (int i = 0; i < trace->num_sql_; i++) free(trace->sql_[i]);
+  for (int i = 0; i < trace->num_fingerprints_; i++) {
+    free(trace->fingerprints_[i]);
+  }
+  free(trace->streams_);
+  free(trace->sql_);
+  free(trace->fingerprint_of_);
+  free(trace->fingerprints_);
+  memset(trace, 0, sizeof(*trace));
+}
@@ -4,11 +4,124 @@
 
 #include "bench.h"
 
-uint64_t now_micros() {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
+#include <sys/resource.h>
+#include <sys/stat.h>
 
-  return (uint64_t)(tv.tv_sec * 1000000 + tv.tv_usec);
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+/* Clock source of now_nanos(), chosen by clock_init() */
+static bool use_tsc_ = false;
+static double tsc_nanos_per_tick_;
+static uint64_t tsc_base_;
+static uint64_t tsc_base_nanos_;
+
+static uint64_t monotonic_nanos() {
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+  /* Not slewed by NTP */
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static double overhead_nanos_;
+
+/*
+ * Select the clock behind now_nanos(): "monotonic" or "tsc".  The TSC is
+ * calibrated against the monotonic clock and is only accepted when the CPU
+ * reports an invariant TSC.  Returns false if the source is unavailable.
+ */
+static bool clock_select(const char* source) {
+  use_tsc_ = false;
+  if (!strcmp(source, "monotonic")) return true;
+  if (strcmp(source, "tsc")) return false;
+#ifdef HAVE_TSC
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+      !(edx & (1 << 8))) {
+    return false;
+  }
+  uint64_t nanos = monotonic_nanos();
+  uint64_t ticks = __rdtsc();
+  sleep_micros(50000);
+  tsc_base_nanos_ = monotonic_nanos();
+  tsc_base_ = __rdtsc();
+  tsc_nanos_per_tick_ =
+    (double)(tsc_base_nanos_ - nanos) / (double)(tsc_base_ - ticks);
+  use_tsc_ = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint64_t now_nanos() {
+#ifdef HAVE_TSC
+  if (use_tsc_) {
+    return tsc_base_nanos_ +
+           (uint64_t)((double)(__rdtsc() - tsc_base_) * tsc_nanos_per_tick_);
+  }
+#endif
+  return monotonic_nanos();
+}
+
+static double measure_overhead_nanos() {
+  const int kCalls = 1000000;
+  volatile uint64_t sink = 0;
+  uint64_t start = now_nanos();
+  for (int i = 0; i < kCalls; i++) {
+    sink += now_nanos();
+  }
+  (void)sink;
+
+  return (double)(now_nanos() - start) / kCalls;
+}
+
+/* Select the clock and measure what reading it costs */
+bool clock_init(const char* source) {
+  if (!clock_select(source)) return false;
+  overhead_nanos_ = measure_overhead_nanos();
+  return true;
+}
+
+/* Average cost of one now_nanos() call, in nanoseconds */
+double clock_overhead_nanos() {
+  return overhead_nanos_;
+}
+
+void sleep_micros(uint64_t micros) {
+  struct timespec ts;
+  ts.tv_sec = micros / 1000000;
+  ts.tv_nsec = (micros % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) == -1) {}
+}
+
+/* Page faults taken so far by the calling thread */
+void thread_faults(int64_t* minor, int64_t* major) {
+  struct rusage ru;
+#ifdef RUSAGE_THREAD
+  getrusage(RUSAGE_THREAD, &ru);
+#else
+  getrusage(RUSAGE_SELF, &ru);
+#endif
+  *minor = ru.ru_minflt;
+  *major = ru.ru_majflt;
+}
+
+/* Write k as a kKeySize-digit zero-padded decimal, like "%016d" */
+void encode_key(char* buf, int k) {
+  unsigned int v = (unsigned int)k;
+  for (int i = kKeySize - 1; i >= 0; i--) {
+    buf[i] = '0' + v % 10;
+    v /= 10;
+  }
 }
 
 /*
@@ -38,3 +151,26 @@ char* trim_space(const char* s) {
 
   return res;
 }
+
+/* Leading members of the unix VFS's unixFile, which has been laid out
+ * this way since SQLite 3.7 */
+typedef struct UnixFileHead {
+  const sqlite3_io_methods* pMethod;
+  sqlite3_vfs* pVfs;
+  void* pInode;
+  int h;
+} UnixFileHead;
+
+/*
+ * The descriptor of file, opened by the unix VFS as name, or -1 if it
+ * does not refer to that file (a temporary file, or another VFS).
+ */
+int unix_file_fd(sqlite3_file* file, const char* name) {
+  struct stat a, b;
+  int fd = ((UnixFileHead*)file)->h;
+  if (name == NULL || fd < 0 || fstat(fd, &a) != 0 || stat(name, &b) != 0 ||
+      a.st_dev != b.st_dev || a.st_ino != b.st_ino) {
+    return -1;
+  }
+  return fd;
+}
@@ -0,0 +1,197 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * VFS shim that makes the storage under the benchmark look slower
+ * (--read_delay, --write_delay, --sync_delay, --io_throughput).  xRead,
+ * xWrite and xSync do not return before the latency drawn for the call has
+ * passed since it started, so the real device time counts towards the
+ * emulated one.
+ *
+ * A delay is given in microseconds as
+ *   fixed:MICROS         every call
+ *   uniform:MIN,MAX      uniformly distributed
+ *   file:PATH            drawn from the latencies listed in PATH, one per
+ *                        line, e.g. measured on the target storage
+ */
+
+/* Waits shorter than this are spun, nanosleep() overshoots them */
+#define kDelaySpinNanos 80000
+
+enum DelayKind {
+  DELAY_NONE,
+  DELAY_FIXED,
+  DELAY_UNIFORM,
+  DELAY_FILE
+};
+
+typedef struct DelaySpec {
+  int kind_;
+  uint64_t min_;        /* nanoseconds */
+  uint64_t max_;
+  uint64_t* samples_;   /* DELAY_FILE */
+  int num_samples_;
+} DelaySpec;
+
+static DelaySpec read_delay_;
+static DelaySpec write_delay_;
+static DelaySpec sync_delay_;
+
+/* --io_throughput: reads and writes share one device that transfers
+ * delay_bytes_per_sec_ and is busy until device_free_ */
+static double delay_bytes_per_sec_;
+static uint64_t device_free_;
+static pthread_mutex_t delay_mu_ = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread Random delay_rand_;
+static __thread bool delay_rand_init_ = false;
+
+static VfsShim delay_shim_;
+
+static void delay_load_file(DelaySpec* spec, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    exit(1);
+  }
+  size_t size = 1024;
+  spec->samples_ = bench_malloc(sizeof(uint64_t) * size);
+  spec->num_samples_ = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    double micros;
+    if (line[0] == '#' || sscanf(line, "%lf", &micros) != 1) continue;
+    if (micros < 0) {
+      fprintf(stderr, "%s: negative latency %s", path, line);
+      exit(1);
+    }
+    if ((size_t)spec->num_samples_ == size) {
+      size *= 2;
+      spec->samples_ = bench_realloc(spec->samples_, sizeof(uint64_t) * size);
+    }
+    spec->samples_[spec->num_samples_++] = (uint64_t)(micros * 1e3);
+  }
+  fclose(f);
+  if (spec->num_samples_ == 0) {
+    fprintf(stderr, "%s has no latencies\n", path);
+    exit(1);
+  }
+}
+
+static void delay_parse(DelaySpec* spec, const char* text) {
+  double a, b;
+  char junk;
+  memset(spec, 0, sizeof(*spec));
+  if (text == NULL) return;
+  if (sscanf(text, "fixed:%lf%c", &a, &junk) == 1 && a >= 0) {
+    spec->kind_ = DELAY_FIXED;
+    spec->min_ = spec->max_ = (uint64_t)(a * 1e3);
+  } else if (sscanf(text, "uniform:%lf,%lf%c", &a, &b, &junk) == 2 &&
+             a >= 0 && b >= a) {
+    spec->kind_ = DELAY_UNIFORM;
+    spec->min_ = (uint64_t)(a * 1e3);
+    spec->max_ = (uint64_t)(b * 1e3);
+  } else if (starts_with(text, "file:")) {
+    spec->kind_ = DELAY_FILE;
+    delay_load_file(spec, text + strlen("file:"));
+  } else {
+    fprintf(stderr, "invalid delay '%s'\n", text);
+    exit(1);
+  }
+}
+
+static uint64_t delay_sample(const DelaySpec* spec) {
+  if (!delay_rand_init_) {
+    rand_init(&delay_rand_, (uint32_t)(uintptr_t)&delay_rand_ ^ 1009);
+    delay_rand_init_ = true;
+  }
+  switch (spec->kind_) {
+    case DELAY_FIXED:
+      return spec->min_;
+    case DELAY_UNIFORM:
+      return spec->min_ +
+             (uint64_t)(rand_double(&delay_rand_) * (spec->max_ - spec->min_));
+    case DELAY_FILE:
+      return spec->samples_[rand_uniform(&delay_rand_, spec->num_samples_)];
+    default:
+      return 0;
+  }
+}
+
+static void delay_until(uint64_t deadline) {
+  uint64_t now;
+  while ((now = now_nanos()) < deadline) {
+    if (deadline - now > kDelaySpinNanos) {
+      sleep_micros((deadline - now - kDelaySpinNanos) / 1000);
+    }
+  }
+}
+
+/* Hold a call that started at start until its emulated completion */
+static void delay_io(const DelaySpec* spec, uint64_t start, int64_t bytes) {
+  uint64_t deadline = start + delay_sample(spec);
+  if (delay_bytes_per_sec_ > 0 && bytes > 0) {
+    uint64_t transfer = (uint64_t)(bytes * 1e9 / delay_bytes_per_sec_);
+    pthread_mutex_lock(&delay_mu_);
+    if (device_free_ < start) device_free_ = start;
+    device_free_ += transfer;
+    if (deadline < device_free_) deadline = device_free_;
+    pthread_mutex_unlock(&delay_mu_);
+  }
+  delay_until(deadline);
+}
+
+static int delay_read(sqlite3_file* f, void* buf, int amt, sqlite3_int64 off) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xRead(SHIM_REAL(f), buf, amt, off);
+  delay_io(&read_delay_, start, amt);
+  return rc;
+}
+
+static int delay_write(sqlite3_file* f, const void* buf, int amt,
+                       sqlite3_int64 off) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xWrite(SHIM_REAL(f), buf, amt, off);
+  delay_io(&write_delay_, start, amt);
+  return rc;
+}
+
+static int delay_sync(sqlite3_file* f, int flags) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xSync(SHIM_REAL(f), flags);
+  delay_io(&sync_delay_, start, 0);
+  return rc;
+}
+
+bool vfs_delay_enabled() {
+  return FLAGS_read_delay != NULL || FLAGS_write_delay != NULL ||
+         FLAGS_sync_delay != NULL || FLAGS_io_throughput > 0;
+}
+
+void vfs_delay_init() {
+  delay_parse(&read_delay_, FLAGS_read_delay);
+  delay_parse(&write_delay_, FLAGS_write_delay);
+  delay_parse(&sync_delay_, FLAGS_sync_delay);
+  delay_bytes_per_sec_ = FLAGS_io_throughput * 1048576;
+  device_free_ = 0;
+
+  /* Memory-mapped pages bypass xRead, so reads through them are not
+   * delayed; run with PRAGMA mmap_size=0 to emulate every read */
+  vfs_shim_init(&delay_shim_, "delay", sizeof(ShimFile));
+  delay_shim_.methods_.xRead = delay_read;
+  delay_shim_.methods_.xWrite = delay_write;
+  delay_shim_.methods_.xSync = delay_sync;
+  vfs_shim_register(&delay_shim_);
+}
+
+void vfs_delay_fini() {
+  DelaySpec* specs[] = { &read_delay_, &write_delay_, &sync_delay_ };
+  for (size_t i = 0; i < sizeof(specs) / sizeof(specs[0]); i++) {
+    if (specs[i]->samples_)
+      free(specs[i]->samples_);
+    specs[i]->samples_ = NULL;
+  }
+}
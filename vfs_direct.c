@@ -0,0 +1,230 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * VFS shim for --direct_io.  The database and WAL files opened by the unix
+ * VFS are switched to O_DIRECT, so reads and writes bypass the kernel page
+ * cache and SQLite's own cache (--num_pages) is the only one.
+ *
+ * O_DIRECT transfers must be aligned in memory, offset and length.  Page
+ * writes at aligned offsets from aligned buffers go straight to the file;
+ * everything else (WAL frames, headers, pages smaller than a block) is
+ * staged in a per-file aligned buffer, and the partial first and last
+ * blocks are read, modified and written back.  A write that would leave
+ * the file longer than SQLite wrote is truncated back to the logical end.
+ *
+ * Locking, syncing and the WAL index stay with the unix VFS; memory mapped
+ * I/O is disabled since it would go through the page cache.
+ */
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Logical block size assumed for O_DIRECT; valid for 512e and 4Kn disks */
+#define kDirectAlign 4096
+
+#define ALIGN_DOWN(x) ((x) & ~(int64_t)(kDirectAlign - 1))
+#define ALIGN_UP(x) ALIGN_DOWN((x) + kDirectAlign - 1)
+#define IS_ALIGNED(x) (((uintptr_t)(x) & (kDirectAlign - 1)) == 0)
+
+typedef struct DirectFile {
+  ShimFile shim_;
+  int fd_;              /* -1: pass every call through */
+  char* buf_;           /* aligned staging buffer */
+  size_t buf_size_;
+} DirectFile;
+
+static VfsShim direct_shim_;
+
+/* A staging buffer of at least size bytes, or NULL */
+static char* direct_buffer(DirectFile* file, size_t size) {
+  if (file->buf_size_ < size) {
+    free(file->buf_);
+    file->buf_ = NULL;
+    file->buf_size_ = 0;
+    if (posix_memalign((void**)&file->buf_, kDirectAlign, size) != 0) {
+      return NULL;
+    }
+    file->buf_size_ = size;
+  }
+  return file->buf_;
+}
+
+/*
+ * pread() n bytes; returns bytes read or -1.  A short read is the end of
+ * the file, which direct_write() leaves unaligned: resuming there is not
+ * an aligned transfer and would fail with EINVAL.
+ */
+static ssize_t read_full(int fd, char* buf, size_t n, off_t off) {
+  ssize_t r;
+  do {
+    r = pread(fd, buf, n, off);
+  } while (r < 0 && errno == EINTR);
+  return r;
+}
+
+static bool write_full(int fd, const char* buf, size_t n, off_t off) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t r = pwrite(fd, buf + done, n - done, off + done);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    done += r;
+  }
+  return true;
+}
+
+/* Read the block at off into buf, zero-filled past the end of the file */
+static bool direct_read_block(DirectFile* file, char* buf, int64_t off) {
+  ssize_t got = read_full(file->fd_, buf, kDirectAlign, off);
+  if (got < 0) return false;
+  memset(buf + got, 0, kDirectAlign - got);
+  return true;
+}
+
+static int direct_close(sqlite3_file* f) {
+  DirectFile* file = (DirectFile*)f;
+  int rc = SHIM_REAL(f)->pMethods->xClose(SHIM_REAL(f));
+  free(file->buf_);
+  file->buf_ = NULL;
+  f->pMethods = NULL;
+  return rc;
+}
+
+static int direct_read(sqlite3_file* f, void* buf, int amt,
+                       sqlite3_int64 off) {
+  DirectFile* file = (DirectFile*)f;
+  if (file->fd_ < 0) {
+    return SHIM_REAL(f)->pMethods->xRead(SHIM_REAL(f), buf, amt, off);
+  }
+
+  int64_t start = ALIGN_DOWN(off);
+  int64_t end = ALIGN_UP(off + amt);
+  ssize_t got;
+  if (start == off && end == off + amt && IS_ALIGNED(buf)) {
+    got = read_full(file->fd_, buf, amt, off);
+  } else {
+    char* stage = direct_buffer(file, end - start);
+    if (stage == NULL) return SQLITE_IOERR_NOMEM;
+    got = read_full(file->fd_, stage, end - start, start);
+    if (got >= 0) {
+      got -= off - start;
+      if (got < 0) got = 0;
+      if (got > amt) got = amt;
+      memcpy(buf, stage + (off - start), got);
+    }
+  }
+  if (got < 0) return SQLITE_IOERR_READ;
+  if (got < amt) {
+    memset((char*)buf + got, 0, amt - got);
+    return SQLITE_IOERR_SHORT_READ;
+  }
+  return SQLITE_OK;
+}
+
+static int direct_write(sqlite3_file* f, const void* buf, int amt,
+                        sqlite3_int64 off) {
+  DirectFile* file = (DirectFile*)f;
+  if (file->fd_ < 0) {
+    return SHIM_REAL(f)->pMethods->xWrite(SHIM_REAL(f), buf, amt, off);
+  }
+
+  int64_t start = ALIGN_DOWN(off);
+  int64_t end = ALIGN_UP(off + amt);
+  if (start == off && end == off + amt && IS_ALIGNED(buf)) {
+    return write_full(file->fd_, buf, amt, off) ? SQLITE_OK
+                                                : SQLITE_IOERR_WRITE;
+  }
+
+  char* stage = direct_buffer(file, end - start);
+  if (stage == NULL) return SQLITE_IOERR_NOMEM;
+  int64_t file_end = end;
+  if (end > off + amt) {
+    struct stat st;
+    if (fstat(file->fd_, &st) != 0) return SQLITE_IOERR_WRITE;
+    if (st.st_size < end) {
+      file_end = st.st_size > off + amt ? st.st_size : off + amt;
+    }
+  }
+  /* Fill in the rest of the partial first and last blocks */
+  if (start < off && !direct_read_block(file, stage, start)) {
+    return SQLITE_IOERR_WRITE;
+  }
+  if (end > off + amt && (end - kDirectAlign > start || start == off) &&
+      !direct_read_block(file, stage + (end - kDirectAlign - start),
+                         end - kDirectAlign)) {
+    return SQLITE_IOERR_WRITE;
+  }
+  memcpy(stage + (off - start), buf, amt);
+  if (!write_full(file->fd_, stage, end - start, start)) {
+    return SQLITE_IOERR_WRITE;
+  }
+  if (file_end < end && ftruncate(file->fd_, file_end) != 0) {
+    return SQLITE_IOERR_WRITE;
+  }
+  return SQLITE_OK;
+}
+
+static int direct_fetch(sqlite3_file* f, sqlite3_int64 off, int amt,
+                        void** pp) {
+  if (((DirectFile*)f)->fd_ >= 0) {
+    *pp = NULL;
+    return SQLITE_OK;
+  }
+  return SHIM_REAL(f)->pMethods->xFetch(SHIM_REAL(f), off, amt, pp);
+}
+
+/* Switch the database and WAL files to O_DIRECT once the unix VFS has
+ * opened them */
+static int direct_open(sqlite3_file* f, const char* name, int flags, int rc) {
+  DirectFile* file = (DirectFile*)f;
+  file->fd_ = -1;
+  if (rc == SQLITE_OK && (flags & (SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_WAL))) {
+    int fd = unix_file_fd(SHIM_REAL(f), name);
+    int fl = fd >= 0 ? fcntl(fd, F_GETFL) : -1;
+    if (fl == -1 || fcntl(fd, F_SETFL, fl | O_DIRECT) == -1) {
+      fprintf(stderr, "cannot use O_DIRECT for %s: %s\n", name,
+              fd >= 0 ? strerror(errno) : "not a unix VFS file");
+      exit(1);
+    }
+    file->fd_ = fd;
+    /* Sized for one page plus the partial blocks around it */
+    direct_buffer(file, ALIGN_UP(FLAGS_page_size) + 2 * kDirectAlign);
+  }
+  return rc;
+}
+
+/*
+ * Wrap the default VFS, which must be the unix VFS, and make the wrapper
+ * the default.  Returns false if O_DIRECT is not supported here.
+ */
+bool vfs_direct_init() {
+  vfs_shim_init(&direct_shim_, "direct", sizeof(DirectFile));
+  if (!starts_with(direct_shim_.real_->zName, "unix")) {
+    fprintf(stderr, "direct I/O needs the unix VFS\n");
+    exit(1);
+  }
+  sqlite3_io_methods* m = &direct_shim_.methods_;
+  m->xClose = direct_close;
+  m->xRead = direct_read;
+  m->xWrite = direct_write;
+  m->xFetch = direct_fetch;
+  direct_shim_.open_ = direct_open;
+  vfs_shim_register(&direct_shim_);
+  return true;
+}
+
+#else
+
+bool vfs_direct_init() {
+  return false;
+}
+
+#endif
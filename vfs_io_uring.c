@@ -0,0 +1,466 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * VFS shim for --io_uring that moves the data path of the unix VFS onto
+ * io_uring, through raw system calls so that liburing is not needed.
+ *
+ * xWrite copies the page into a per-thread staging buffer and queues the
+ * write; consecutive writes (WAL appends, checkpoint page writes) build up
+ * a batch that goes to the kernel in one io_uring_enter() call.  xSync
+ * links the batch to an fsync, so a failed write cancels the sync.  Reads
+ * complete the batch only if it writes the same file; locks, the WAL index
+ * and file controls (SQLite 3.32 and later bracket checkpoints with
+ * SQLITE_FCNTL_CKPT_DONE) always do, so other connections never see
+ * the WAL or database before the writes they depend on.  Older SQLite
+ * gets no such signal, so there database writes are not deferred.
+ * With --io_uring_registered the staging buffer is registered with the
+ * ring and written with IORING_OP_WRITE_FIXED.
+ *
+ * Opening, locking and the WAL index stay with the unix VFS; the shim
+ * works on the descriptor from unix_file_fd().
+ */
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define kRingEntries 256
+#define kRingBufferSize (4 << 20)
+
+enum RingOp {
+  RING_READ = 1,
+  RING_WRITE,
+  RING_FSYNC
+};
+
+/* A thread's ring and the staging buffer of its queued writes */
+typedef struct Ring {
+  int fd_;
+  void* sq_ptr_;
+  size_t sq_size_;
+  void* cq_ptr_;
+  size_t cq_size_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  struct io_uring_sqe* sqes_;
+  struct io_uring_cqe* cqes_;
+
+  unsigned queued_;     /* SQEs not yet submitted */
+  unsigned inflight_;   /* submitted, not yet completed */
+  int error_;           /* SQLite error of the last failed write or sync */
+  int read_res_;
+
+  char* buf_;
+  size_t buf_used_;
+} Ring;
+
+typedef struct UringFile {
+  ShimFile shim_;
+  int fd_;              /* -1: pass every call through */
+  bool defer_;          /* may leave writes queued after xWrite returns */
+} UringFile;
+
+static VfsShim uring_shim_;
+static bool uring_registered_;
+static pthread_key_t ring_key_;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                      flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned op, void* arg,
+                                 unsigned n) {
+  return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static void ring_free(void* arg) {
+  Ring* r = arg;
+  if (r == NULL) return;
+  if (r->cq_ptr_ != r->sq_ptr_) munmap(r->cq_ptr_, r->cq_size_);
+  munmap(r->sq_ptr_, r->sq_size_);
+  munmap(r->sqes_, kRingEntries * sizeof(struct io_uring_sqe));
+  close(r->fd_);
+  free(r->buf_);
+  free(r);
+}
+
+static Ring* ring_create() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  Ring* r = calloc(1, sizeof(Ring));
+  r->fd_ = sys_io_uring_setup(kRingEntries, &p);
+  if (r->fd_ < 0) {
+    fprintf(stderr, "io_uring_setup: %s\n", strerror(errno));
+    exit(1);
+  }
+
+  r->sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_size_ > r->sq_size_) r->sq_size_ = r->cq_size_;
+    r->cq_size_ = r->sq_size_;
+  }
+  r->sq_ptr_ = mmap(NULL, r->sq_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd_, IORING_OFF_SQ_RING);
+  r->cq_ptr_ = r->sq_ptr_;
+  if (r->sq_ptr_ != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    r->cq_ptr_ = mmap(NULL, r->cq_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd_, IORING_OFF_CQ_RING);
+  }
+  r->sqes_ = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd_,
+                  IORING_OFF_SQES);
+  if (r->sq_ptr_ == MAP_FAILED || r->cq_ptr_ == MAP_FAILED ||
+      r->sqes_ == MAP_FAILED) {
+    fprintf(stderr, "io_uring mmap: %s\n", strerror(errno));
+    exit(1);
+  }
+  char* sq = r->sq_ptr_;
+  char* cq = r->cq_ptr_;
+  r->sq_head_ = (unsigned*)(sq + p.sq_off.head);
+  r->sq_tail_ = (unsigned*)(sq + p.sq_off.tail);
+  r->sq_mask_ = (unsigned*)(sq + p.sq_off.ring_mask);
+  r->sq_array_ = (unsigned*)(sq + p.sq_off.array);
+  r->cq_head_ = (unsigned*)(cq + p.cq_off.head);
+  r->cq_tail_ = (unsigned*)(cq + p.cq_off.tail);
+  r->cq_mask_ = (unsigned*)(cq + p.cq_off.ring_mask);
+  r->cqes_ = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+  if (posix_memalign((void**)&r->buf_, 4096, kRingBufferSize) != 0) {
+    fprintf(stderr, "posix_memalign failed\n");
+    exit(1);
+  }
+  if (uring_registered_) {
+    struct iovec iov = { r->buf_, kRingBufferSize };
+    if (sys_io_uring_register(r->fd_, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+      fprintf(stderr, "io_uring_register: %s\n", strerror(errno));
+      exit(1);
+    }
+  }
+  return r;
+}
+
+static Ring* ring_get() {
+  Ring* r = pthread_getspecific(ring_key_);
+  if (r == NULL) {
+    r = ring_create();
+    pthread_setspecific(ring_key_, r);
+  }
+  return r;
+}
+
+static void ring_reap(Ring* r) {
+  unsigned head = *r->cq_head_;
+  unsigned tail = __atomic_load_n(r->cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe* cqe = &r->cqes_[head & *r->cq_mask_];
+    int op = (int)(cqe->user_data >> 32);
+    unsigned len = (unsigned)cqe->user_data;
+    if (op == RING_READ) {
+      r->read_res_ = cqe->res;
+    } else if (op == RING_WRITE && cqe->res != (int)len) {
+      if (r->error_ == SQLITE_OK) r->error_ = SQLITE_IOERR_WRITE;
+    } else if (op == RING_FSYNC && cqe->res < 0) {
+      if (r->error_ == SQLITE_OK) r->error_ = SQLITE_IOERR_FSYNC;
+    }
+    r->inflight_--;
+  }
+  __atomic_store_n(r->cq_head_, head, __ATOMIC_RELEASE);
+}
+
+/* Submit everything queued and wait for all of it to complete */
+static int ring_flush(Ring* r) {
+  while (r->queued_ > 0 || r->inflight_ > 0) {
+    int n = sys_io_uring_enter(r->fd_, r->queued_, r->queued_ + r->inflight_,
+                               IORING_ENTER_GETEVENTS);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+      exit(1);
+    }
+    r->queued_ -= n;
+    r->inflight_ += n;
+    ring_reap(r);
+  }
+  r->buf_used_ = 0;
+  int rc = r->error_;
+  r->error_ = SQLITE_OK;
+  return rc;
+}
+
+static struct io_uring_sqe* ring_sqe(Ring* r) {
+  unsigned tail = *r->sq_tail_;
+  unsigned index = tail & *r->sq_mask_;
+  struct io_uring_sqe* sqe = &r->sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array_[index] = index;
+  __atomic_store_n(r->sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  r->queued_++;
+  return sqe;
+}
+
+/* Whether the queued writes include one to fd */
+static bool ring_writes_to(Ring* r, int fd) {
+  unsigned tail = *r->sq_tail_;
+  for (unsigned i = 1; i <= r->queued_; i++) {
+    if (r->sqes_[(tail - i) & *r->sq_mask_].fd == fd) return true;
+  }
+  return false;
+}
+
+/* Complete the writes this thread has queued, for any file */
+static int uring_flush() {
+  Ring* r = pthread_getspecific(ring_key_);
+  if (r == NULL || (r->queued_ == 0 && r->inflight_ == 0)) return SQLITE_OK;
+  return ring_flush(r);
+}
+
+static int uring_close(sqlite3_file* f) {
+  int rc = uring_flush();
+  int rc2 = SHIM_REAL(f)->pMethods->xClose(SHIM_REAL(f));
+  f->pMethods = NULL;
+  return rc != SQLITE_OK ? rc : rc2;
+}
+
+/* Complete the queued writes if any of them is to f */
+static int uring_flush_file(sqlite3_file* f) {
+  Ring* r = pthread_getspecific(ring_key_);
+  if (r == NULL || !ring_writes_to(r, ((UringFile*)f)->fd_)) return SQLITE_OK;
+  return ring_flush(r);
+}
+
+static int uring_read(sqlite3_file* f, void* buf, int amt, sqlite3_int64 off) {
+  UringFile* file = (UringFile*)f;
+  if (file->fd_ < 0) {
+    return SHIM_REAL(f)->pMethods->xRead(SHIM_REAL(f), buf, amt, off);
+  }
+  int rc = uring_flush_file(f);
+  if (rc != SQLITE_OK) return rc;
+
+  /* Submitted together with whatever writes to other files are queued */
+  Ring* r = ring_get();
+  struct io_uring_sqe* sqe = ring_sqe(r);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = file->fd_;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = amt;
+  sqe->off = off;
+  sqe->user_data = ((uint64_t)RING_READ << 32) | (unsigned)amt;
+  rc = ring_flush(r);
+  if (rc != SQLITE_OK) return rc;
+  if (r->read_res_ < 0) return SQLITE_IOERR_READ;
+  if (r->read_res_ < amt) {
+    memset((char*)buf + r->read_res_, 0, amt - r->read_res_);
+    return SQLITE_IOERR_SHORT_READ;
+  }
+  return SQLITE_OK;
+}
+
+static int uring_write(sqlite3_file* f, const void* buf, int amt,
+                       sqlite3_int64 off) {
+  UringFile* file = (UringFile*)f;
+  if (file->fd_ < 0 || amt > kRingBufferSize) {
+    int rc = uring_flush();
+    if (rc != SQLITE_OK) return rc;
+    return SHIM_REAL(f)->pMethods->xWrite(SHIM_REAL(f), buf, amt, off);
+  }
+
+  Ring* r = ring_get();
+  if (r->queued_ == kRingEntries - 1 ||
+      r->buf_used_ + amt > kRingBufferSize) {
+    /* Leave a slot for the fsync that may be linked to this batch */
+    int rc = ring_flush(r);
+    if (rc != SQLITE_OK) return rc;
+  }
+  char* copy = r->buf_ + r->buf_used_;
+  memcpy(copy, buf, amt);
+  struct io_uring_sqe* sqe = ring_sqe(r);
+  sqe->opcode = uring_registered_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd = file->fd_;
+  sqe->addr = (uintptr_t)copy;
+  sqe->len = amt;
+  sqe->off = off;
+  sqe->buf_index = 0;
+  sqe->user_data = ((uint64_t)RING_WRITE << 32) | (unsigned)amt;
+  /* Keep the batch 8-byte aligned for the next copy */
+  r->buf_used_ += (amt + 7) & ~7;
+  return file->defer_ ? SQLITE_OK : ring_flush(r);
+}
+
+static int uring_truncate(sqlite3_file* f, sqlite3_int64 size) {
+  int rc = uring_flush_file(f);
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xTruncate(SHIM_REAL(f), size);
+}
+
+/*
+ * Link the queued writes and an fsync of this file into one chain.  Unlike
+ * the unix VFS this does not sync the directory of a newly created file.
+ */
+static int uring_sync(sqlite3_file* f, int flags) {
+  UringFile* file = (UringFile*)f;
+  if (file->fd_ < 0) {
+    int rc = uring_flush();
+    if (rc != SQLITE_OK) return rc;
+    return SHIM_REAL(f)->pMethods->xSync(SHIM_REAL(f), flags);
+  }
+
+  Ring* r = ring_get();
+  unsigned tail = *r->sq_tail_;
+  for (unsigned i = 0; i < r->queued_; i++) {
+    r->sqes_[(tail - r->queued_ + i) & *r->sq_mask_].flags |= IOSQE_IO_LINK;
+  }
+  struct io_uring_sqe* sqe = ring_sqe(r);
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = file->fd_;
+  if (flags & SQLITE_SYNC_DATAONLY) sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->user_data = (uint64_t)RING_FSYNC << 32;
+  return ring_flush(r);
+}
+
+static int uring_file_size(sqlite3_file* f, sqlite3_int64* size) {
+  int rc = uring_flush_file(f);
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xFileSize(SHIM_REAL(f), size);
+}
+
+static int uring_lock(sqlite3_file* f, int lock) {
+  int rc = uring_flush();
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xLock(SHIM_REAL(f), lock);
+}
+
+static int uring_unlock(sqlite3_file* f, int lock) {
+  int rc = uring_flush();
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xUnlock(SHIM_REAL(f), lock);
+}
+
+static int uring_file_control(sqlite3_file* f, int op, void* arg) {
+  int rc = uring_flush();
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xFileControl(SHIM_REAL(f), op, arg);
+}
+
+static int uring_shm_map(sqlite3_file* f, int region, int size, int extend,
+                         void volatile** pp) {
+  int rc = uring_flush();
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xShmMap(SHIM_REAL(f), region, size, extend,
+                                         pp);
+}
+
+static int uring_shm_lock(sqlite3_file* f, int offset, int n, int flags) {
+  int rc = uring_flush();
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xShmLock(SHIM_REAL(f), offset, n, flags);
+}
+
+/* WAL frames must be in the file before the WAL index points at them */
+static void uring_shm_barrier(sqlite3_file* f) {
+  uring_flush();
+  SHIM_REAL(f)->pMethods->xShmBarrier(SHIM_REAL(f));
+}
+
+static int uring_shm_unmap(sqlite3_file* f, int delete_flag) {
+  int rc = uring_flush();
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xShmUnmap(SHIM_REAL(f), delete_flag);
+}
+
+static int uring_fetch(sqlite3_file* f, sqlite3_int64 off, int amt,
+                       void** pp) {
+  int rc = uring_flush();
+  if (rc != SQLITE_OK) return rc;
+  return SHIM_REAL(f)->pMethods->xFetch(SHIM_REAL(f), off, amt, pp);
+}
+
+static int uring_open(sqlite3_file* f, const char* name, int flags, int rc) {
+  UringFile* file = (UringFile*)f;
+  file->fd_ = -1;
+  if (rc == SQLITE_OK) file->fd_ = unix_file_fd(SHIM_REAL(f), name);
+  file->defer_ = !(flags & SQLITE_OPEN_MAIN_DB) ||
+                 sqlite3_libversion_number() >= 3032000;
+  return rc;
+}
+
+/*
+ * Wrap the default VFS, which must be the unix VFS, and make the wrapper
+ * the default.  Returns false if io_uring is not usable here.
+ */
+bool vfs_io_uring_init(bool registered) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = sys_io_uring_setup(1, &p);
+  if (fd < 0) return false;
+  close(fd);
+
+  vfs_shim_init(&uring_shim_, "io_uring", sizeof(UringFile));
+  if (!starts_with(uring_shim_.real_->zName, "unix")) {
+    fprintf(stderr, "io_uring needs the unix VFS\n");
+    exit(1);
+  }
+  uring_registered_ = registered;
+  pthread_key_create(&ring_key_, ring_free);
+  sqlite3_io_methods* m = &uring_shim_.methods_;
+  m->xClose = uring_close;
+  m->xRead = uring_read;
+  m->xWrite = uring_write;
+  m->xTruncate = uring_truncate;
+  m->xSync = uring_sync;
+  m->xFileSize = uring_file_size;
+  m->xLock = uring_lock;
+  m->xUnlock = uring_unlock;
+  m->xFileControl = uring_file_control;
+  m->xShmMap = uring_shm_map;
+  m->xShmLock = uring_shm_lock;
+  m->xShmBarrier = uring_shm_barrier;
+  m->xShmUnmap = uring_shm_unmap;
+  m->xFetch = uring_fetch;
+  uring_shim_.open_ = uring_open;
+  vfs_shim_register(&uring_shim_);
+  return true;
+}
+
+/* Release the calling thread's ring; other threads release theirs on exit */
+void vfs_io_uring_fini() {
+  ring_free(pthread_getspecific(ring_key_));
+  pthread_setspecific(ring_key_, NULL);
+}
+
+#else
+
+bool vfs_io_uring_init(bool registered) {
+  return false;
+}
+
+void vfs_io_uring_fini() {
+}
+
+#endif
@@ -0,0 +1,65 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * VFS shim for --madvise.  With --mmap_size, SQLite reads pages through a
+ * mapping of the database that it makes itself; the shim learns where that
+ * mapping is from the pointers xFetch returns (the file is mapped from
+ * offset 0) and applies the advice to it whenever it moves or grows.
+ */
+
+typedef struct MadviseFile {
+  ShimFile shim_;
+  char* map_;           /* start of the mapping last advised */
+  int64_t map_len_;     /* bytes advised */
+} MadviseFile;
+
+static VfsShim madvise_shim_;
+static int advice_;
+
+static int madvise_fetch(sqlite3_file* f, sqlite3_int64 off, int amt,
+                         void** pp) {
+  MadviseFile* file = (MadviseFile*)f;
+  sqlite3_file* real = SHIM_REAL(f);
+  int rc = real->pMethods->xFetch(real, off, amt, pp);
+  if (rc != SQLITE_OK || *pp == NULL) return rc;
+
+  char* map = (char*)*pp - off;
+  if (map != file->map_ || off + amt > file->map_len_) {
+    /* Advise up to the end of the file or of --mmap_size, page-rounded */
+    sqlite3_int64 size;
+    if (real->pMethods->xFileSize(real, &size) != SQLITE_OK) {
+      size = off + amt;
+    }
+    if (size > FLAGS_mmap_size) size = FLAGS_mmap_size;
+    if (size < off + amt) size = off + amt;
+    int64_t page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+    madvise(map, size, advice_);
+    file->map_ = map;
+    file->map_len_ = size;
+  }
+  return rc;
+}
+
+/* MADV_* value of a --madvise name, or -1 */
+int madvise_from_string(const char* name) {
+  if (!strcmp(name, "normal")) return MADV_NORMAL;
+  if (!strcmp(name, "random")) return MADV_RANDOM;
+  if (!strcmp(name, "sequential")) return MADV_SEQUENTIAL;
+  if (!strcmp(name, "willneed")) return MADV_WILLNEED;
+  return -1;
+}
+
+void vfs_madvise_init(const char* advice) {
+  advice_ = madvise_from_string(advice);
+  vfs_shim_init(&madvise_shim_, "madvise", sizeof(MadviseFile));
+  madvise_shim_.methods_.xFetch = madvise_fetch;
+  vfs_shim_register(&madvise_shim_);
+}
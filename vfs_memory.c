@@ -0,0 +1,454 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * In-process storage for --storage=memory.  Files live in a table keyed by
+ * name, so every connection of the process that opens the same name shares
+ * one copy, with the database and WAL-index locks of the unix VFS emulated
+ * between them.  Benchmarks then measure SQLite's CPU cost without any
+ * file system underneath; xSync is free.
+ *
+ * File contents stand in for the file system and are not counted by
+ * --alloc_stats.
+ */
+
+/* The contents and locks of a named file */
+typedef struct MemoryNode {
+  char* name_;
+  char* data_;
+  int64_t size_;
+  int64_t alloc_;
+  pthread_rwlock_t data_mu_;  /* guards data_, size_ and alloc_ */
+  int refs_;                  /* open handles */
+  bool linked_;               /* still in the name table */
+  struct MemoryNode* next_;
+
+  /* Database file locks, see sqlite3_io_methods.xLock */
+  int shared_;
+  struct MemoryFile* reserved_;
+  struct MemoryFile* pending_;
+  struct MemoryFile* exclusive_;
+
+  /* WAL index */
+  char** shm_;
+  int shm_len_;
+  int shm_shared_[SQLITE_SHM_NLOCK];
+  struct MemoryFile* shm_exclusive_[SQLITE_SHM_NLOCK];
+} MemoryNode;
+
+/* An open file */
+typedef struct MemoryFile {
+  sqlite3_file base_;
+  MemoryNode* node_;
+  int lock_;
+  bool delete_on_close_;
+  uint16_t shm_shared_;       /* WAL-index locks held, one bit each */
+  uint16_t shm_exclusive_;
+} MemoryFile;
+
+/* Guards the name table and all locks */
+static pthread_mutex_t memory_mu_ = PTHREAD_MUTEX_INITIALIZER;
+static MemoryNode* memory_nodes_ = NULL;
+
+static VfsShim memory_shim_;
+
+#define NODE(f) (((MemoryFile*)(f))->node_)
+
+static MemoryNode* memory_find(const char* name) {
+  for (MemoryNode* n = memory_nodes_; n != NULL; n = n->next_) {
+    if (!strcmp(n->name_, name)) return n;
+  }
+  return NULL;
+}
+
+static void memory_unlink(MemoryNode* node) {
+  for (MemoryNode** p = &memory_nodes_; *p != NULL; p = &(*p)->next_) {
+    if (*p == node) {
+      *p = node->next_;
+      break;
+    }
+  }
+  node->linked_ = false;
+}
+
+static void memory_free_node(MemoryNode* node) {
+  for (int i = 0; i < node->shm_len_; i++) {
+    free(node->shm_[i]);
+  }
+  free(node->shm_);
+  free(node->data_);
+  free(node->name_);
+  pthread_rwlock_destroy(&node->data_mu_);
+  free(node);
+}
+
+static int memory_unlock(sqlite3_file* f, int lock) {
+  MemoryFile* file = (MemoryFile*)f;
+  MemoryNode* node = file->node_;
+  if (file->lock_ <= lock) return SQLITE_OK;
+  pthread_mutex_lock(&memory_mu_);
+  if (node->reserved_ == file) node->reserved_ = NULL;
+  if (node->pending_ == file) node->pending_ = NULL;
+  if (node->exclusive_ == file) node->exclusive_ = NULL;
+  if (lock == SQLITE_LOCK_NONE) node->shared_--;
+  file->lock_ = lock;
+  pthread_mutex_unlock(&memory_mu_);
+  return SQLITE_OK;
+}
+
+/* Release the WAL-index locks in mask; memory_mu_ must be held */
+static void memory_shm_release(MemoryFile* file, uint16_t mask) {
+  MemoryNode* node = file->node_;
+  for (int i = 0; i < SQLITE_SHM_NLOCK; i++) {
+    if (!(mask & (1 << i))) continue;
+    if (file->shm_shared_ & (1 << i)) node->shm_shared_[i]--;
+    if (file->shm_exclusive_ & (1 << i)) node->shm_exclusive_[i] = NULL;
+  }
+  file->shm_shared_ &= ~mask;
+  file->shm_exclusive_ &= ~mask;
+}
+
+static int memory_close(sqlite3_file* f) {
+  MemoryFile* file = (MemoryFile*)f;
+  MemoryNode* node = file->node_;
+  memory_unlock(f, SQLITE_LOCK_NONE);
+  pthread_mutex_lock(&memory_mu_);
+  memory_shm_release(file, 0xffff);
+  node->refs_--;
+  if (file->delete_on_close_ && node->linked_) memory_unlink(node);
+  if (node->refs_ == 0 && !node->linked_) memory_free_node(node);
+  pthread_mutex_unlock(&memory_mu_);
+  f->pMethods = NULL;
+  return SQLITE_OK;
+}
+
+static int memory_read(sqlite3_file* f, void* buf, int amt,
+                       sqlite3_int64 off) {
+  MemoryNode* node = NODE(f);
+  int rc = SQLITE_OK;
+  pthread_rwlock_rdlock(&node->data_mu_);
+  if (off + amt > node->size_) {
+    int64_t avail = off < node->size_ ? node->size_ - off : 0;
+    if (avail > 0) memcpy(buf, node->data_ + off, avail);
+    memset((char*)buf + avail, 0, amt - avail);
+    rc = SQLITE_IOERR_SHORT_READ;
+  } else {
+    memcpy(buf, node->data_ + off, amt);
+  }
+  pthread_rwlock_unlock(&node->data_mu_);
+  return rc;
+}
+
+static int memory_write(sqlite3_file* f, const void* buf, int amt,
+                        sqlite3_int64 off) {
+  MemoryNode* node = NODE(f);
+  int rc = SQLITE_OK;
+  pthread_rwlock_wrlock(&node->data_mu_);
+  if (off + amt > node->alloc_) {
+    /* Grow geometrically so appends stay amortized O(1) */
+    int64_t alloc = node->alloc_ > 0 ? node->alloc_ : 65536;
+    while (alloc < off + amt) alloc *= 2;
+    char* data = realloc(node->data_, alloc);
+    if (data == NULL) {
+      rc = SQLITE_IOERR_NOMEM;
+    } else {
+      node->data_ = data;
+      node->alloc_ = alloc;
+    }
+  }
+  if (rc == SQLITE_OK) {
+    if (off > node->size_) memset(node->data_ + node->size_, 0,
+                                  off - node->size_);
+    memcpy(node->data_ + off, buf, amt);
+    if (off + amt > node->size_) node->size_ = off + amt;
+  }
+  pthread_rwlock_unlock(&node->data_mu_);
+  return rc;
+}
+
+static int memory_truncate(sqlite3_file* f, sqlite3_int64 size) {
+  MemoryNode* node = NODE(f);
+  pthread_rwlock_wrlock(&node->data_mu_);
+  if (size < node->size_) node->size_ = size;
+  pthread_rwlock_unlock(&node->data_mu_);
+  return SQLITE_OK;
+}
+
+static int memory_sync(sqlite3_file* f, int flags) {
+  return SQLITE_OK;
+}
+
+static int memory_file_size(sqlite3_file* f, sqlite3_int64* size) {
+  MemoryNode* node = NODE(f);
+  pthread_rwlock_rdlock(&node->data_mu_);
+  *size = node->size_;
+  pthread_rwlock_unlock(&node->data_mu_);
+  return SQLITE_OK;
+}
+
+static int memory_lock(sqlite3_file* f, int lock) {
+  MemoryFile* file = (MemoryFile*)f;
+  MemoryNode* node = file->node_;
+  int rc = SQLITE_OK;
+  if (file->lock_ >= lock) return SQLITE_OK;
+  pthread_mutex_lock(&memory_mu_);
+  if (lock == SQLITE_LOCK_SHARED) {
+    if (node->pending_ != NULL || node->exclusive_ != NULL) {
+      rc = SQLITE_BUSY;
+    } else {
+      node->shared_++;
+      file->lock_ = SQLITE_LOCK_SHARED;
+    }
+  } else if (lock == SQLITE_LOCK_RESERVED) {
+    if (node->reserved_ != NULL) {
+      rc = SQLITE_BUSY;
+    } else {
+      node->reserved_ = file;
+      file->lock_ = SQLITE_LOCK_RESERVED;
+    }
+  } else if (node->pending_ != NULL && node->pending_ != file) {
+    rc = SQLITE_BUSY;
+  } else {
+    /* PENDING keeps new readers out until the existing ones are gone */
+    node->pending_ = file;
+    if (node->shared_ > 1) {
+      file->lock_ = SQLITE_LOCK_PENDING;
+      rc = SQLITE_BUSY;
+    } else {
+      node->exclusive_ = file;
+      file->lock_ = SQLITE_LOCK_EXCLUSIVE;
+    }
+  }
+  pthread_mutex_unlock(&memory_mu_);
+  return rc;
+}
+
+static int memory_check_reserved_lock(sqlite3_file* f, int* out) {
+  MemoryNode* node = NODE(f);
+  pthread_mutex_lock(&memory_mu_);
+  *out = node->reserved_ != NULL || node->pending_ != NULL ||
+         node->exclusive_ != NULL;
+  pthread_mutex_unlock(&memory_mu_);
+  return SQLITE_OK;
+}
+
+static int memory_file_control(sqlite3_file* f, int op, void* arg) {
+  return SQLITE_NOTFOUND;
+}
+
+static int memory_sector_size(sqlite3_file* f) {
+  return 512;
+}
+
+/* Same as the unix VFS on a typical disk, so SQLite takes the same paths */
+static int memory_device_characteristics(sqlite3_file* f) {
+  return SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+}
+
+static int memory_shm_map(sqlite3_file* f, int region, int size, int extend,
+                          void volatile** pp) {
+  MemoryNode* node = NODE(f);
+  int rc = SQLITE_OK;
+  pthread_mutex_lock(&memory_mu_);
+  if (region >= node->shm_len_ && extend) {
+    char** shm = realloc(node->shm_, sizeof(char*) * (region + 1));
+    if (shm == NULL) {
+      rc = SQLITE_IOERR_NOMEM;
+    } else {
+      node->shm_ = shm;
+      for (; node->shm_len_ <= region; node->shm_len_++) {
+        node->shm_[node->shm_len_] = calloc(1, size);
+        if (node->shm_[node->shm_len_] == NULL) {
+          rc = SQLITE_IOERR_NOMEM;
+          break;
+        }
+      }
+    }
+  }
+  *pp = region < node->shm_len_ ? node->shm_[region] : NULL;
+  pthread_mutex_unlock(&memory_mu_);
+  return rc;
+}
+
+static int memory_shm_lock(sqlite3_file* f, int offset, int n, int flags) {
+  MemoryFile* file = (MemoryFile*)f;
+  MemoryNode* node = file->node_;
+  uint16_t mask = (uint16_t)(((1 << n) - 1) << offset);
+  int rc = SQLITE_OK;
+  pthread_mutex_lock(&memory_mu_);
+  if (flags & SQLITE_SHM_UNLOCK) {
+    memory_shm_release(file, mask);
+  } else if (flags & SQLITE_SHM_SHARED) {
+    for (int i = offset; i < offset + n; i++) {
+      if (node->shm_exclusive_[i] != NULL && node->shm_exclusive_[i] != file)
+        rc = SQLITE_BUSY;
+    }
+    if (rc == SQLITE_OK && !(file->shm_shared_ & mask)) {
+      for (int i = offset; i < offset + n; i++) node->shm_shared_[i]++;
+      file->shm_shared_ |= mask;
+    }
+  } else {
+    for (int i = offset; i < offset + n; i++) {
+      int others = node->shm_shared_[i] -
+                   ((file->shm_shared_ & (1 << i)) ? 1 : 0);
+      if ((node->shm_exclusive_[i] != NULL &&
+           node->shm_exclusive_[i] != file) || others > 0)
+        rc = SQLITE_BUSY;
+    }
+    if (rc == SQLITE_OK) {
+      for (int i = offset; i < offset + n; i++) {
+        node->shm_exclusive_[i] = file;
+      }
+      file->shm_exclusive_ |= mask;
+    }
+  }
+  pthread_mutex_unlock(&memory_mu_);
+  return rc;
+}
+
+static void memory_shm_barrier(sqlite3_file* f) {
+  __sync_synchronize();
+}
+
+static int memory_shm_unmap(sqlite3_file* f, int delete_flag) {
+  MemoryFile* file = (MemoryFile*)f;
+  MemoryNode* node = file->node_;
+  pthread_mutex_lock(&memory_mu_);
+  memory_shm_release(file, 0xffff);
+  if (delete_flag) {
+    for (int i = 0; i < node->shm_len_; i++) {
+      free(node->shm_[i]);
+    }
+    free(node->shm_);
+    node->shm_ = NULL;
+    node->shm_len_ = 0;
+  }
+  pthread_mutex_unlock(&memory_mu_);
+  return SQLITE_OK;
+}
+
+/* Pages may move when a file grows, so there is nothing to map */
+static int memory_fetch(sqlite3_file* f, sqlite3_int64 off, int amt,
+                        void** pp) {
+  *pp = NULL;
+  return SQLITE_OK;
+}
+
+static int memory_unfetch(sqlite3_file* f, sqlite3_int64 off, void* p) {
+  return SQLITE_OK;
+}
+
+static const sqlite3_io_methods memory_io_methods = {
+  3,
+  memory_close, memory_read, memory_write, memory_truncate, memory_sync,
+  memory_file_size, memory_lock, memory_unlock, memory_check_reserved_lock,
+  memory_file_control, memory_sector_size, memory_device_characteristics,
+  memory_shm_map, memory_shm_lock, memory_shm_barrier, memory_shm_unmap,
+  memory_fetch, memory_unfetch
+};
+
+static int memory_open(sqlite3_vfs* vfs, const char* name, sqlite3_file* f,
+                       int flags, int* out_flags) {
+  MemoryFile* file = (MemoryFile*)f;
+  memset(file, 0, sizeof(*file));
+  pthread_mutex_lock(&memory_mu_);
+  MemoryNode* node = name ? memory_find(name) : NULL;
+  if (node == NULL) {
+    if (name != NULL && !(flags & SQLITE_OPEN_CREATE)) {
+      pthread_mutex_unlock(&memory_mu_);
+      return SQLITE_CANTOPEN;
+    }
+    node = calloc(1, sizeof(MemoryNode));
+    if (node == NULL) {
+      pthread_mutex_unlock(&memory_mu_);
+      return SQLITE_NOMEM;
+    }
+    pthread_rwlock_init(&node->data_mu_, NULL);
+    /* Temporary files have no name and are never shared */
+    node->name_ = strdup(name ? name : "");
+    if (name != NULL) {
+      node->next_ = memory_nodes_;
+      memory_nodes_ = node;
+      node->linked_ = true;
+    }
+  }
+  node->refs_++;
+  pthread_mutex_unlock(&memory_mu_);
+
+  file->node_ = node;
+  file->delete_on_close_ = (flags & SQLITE_OPEN_DELETEONCLOSE) != 0;
+  f->pMethods = &memory_io_methods;
+  if (out_flags) *out_flags = flags;
+  return SQLITE_OK;
+}
+
+static int memory_delete(sqlite3_vfs* vfs, const char* name, int sync_dir) {
+  int rc = SQLITE_IOERR_DELETE_NOENT;
+  pthread_mutex_lock(&memory_mu_);
+  MemoryNode* node = memory_find(name);
+  if (node != NULL) {
+    memory_unlink(node);
+    if (node->refs_ == 0) memory_free_node(node);
+    rc = SQLITE_OK;
+  }
+  pthread_mutex_unlock(&memory_mu_);
+  return rc;
+}
+
+static int memory_access(sqlite3_vfs* vfs, const char* name, int flags,
+                         int* out) {
+  pthread_mutex_lock(&memory_mu_);
+  MemoryNode* node = memory_find(name);
+  /* Like the unix VFS, an empty file does not exist (no hot journal) */
+  if (flags == SQLITE_ACCESS_EXISTS && node != NULL) {
+    pthread_rwlock_rdlock(&node->data_mu_);
+    *out = node->size_ > 0;
+    pthread_rwlock_unlock(&node->data_mu_);
+  } else {
+    *out = node != NULL;
+  }
+  pthread_mutex_unlock(&memory_mu_);
+  return SQLITE_OK;
+}
+
+static int memory_full_pathname(sqlite3_vfs* vfs, const char* name, int n,
+                                char* out) {
+  sqlite3_snprintf(n, out, "%s", name);
+  return SQLITE_OK;
+}
+
+/*
+ * Register the memory VFS as the default.  It keeps files of its own and
+ * passes everything else (dynamic libraries, randomness, sleep, time) on
+ * to the VFS that was the default before.
+ */
+void vfs_memory_init() {
+  vfs_shim_init(&memory_shim_, "memory", sizeof(MemoryFile));
+  sqlite3_vfs* vfs = &memory_shim_.vfs_;
+  vfs->szOsFile = sizeof(MemoryFile);
+  vfs->mxPathname = 512;
+  vfs->xOpen = memory_open;
+  vfs->xDelete = memory_delete;
+  vfs->xAccess = memory_access;
+  vfs->xFullPathname = memory_full_pathname;
+  vfs_shim_register(&memory_shim_);
+}
+
+/* Drop every file that is not open, like removing old databases on disk */
+void vfs_memory_clear() {
+  pthread_mutex_lock(&memory_mu_);
+  MemoryNode** p = &memory_nodes_;
+  while (*p != NULL) {
+    MemoryNode* node = *p;
+    if (node->refs_ == 0) {
+      *p = node->next_;
+      memory_free_node(node);
+    } else {
+      p = &node->next_;
+    }
+  }
+  pthread_mutex_unlock(&memory_mu_);
+}
@@ -0,0 +1,241 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * Common part of the VFS shims (--vfs_stats, the delays, --io_uring,
+ * --direct_io, --madvise) and of --storage=memory.  A shim wraps the VFS
+ * that is the default when it is set up, becomes the default itself and
+ * forwards every call it does not override.  Each open file is the shim's
+ * file struct, which starts with a ShimFile, followed by the real file in
+ * the same allocation.
+ */
+
+#define SHIM(vfs) ((VfsShim*)(vfs)->pAppData)
+
+static int shim_close(sqlite3_file* f) {
+  int rc = SHIM_REAL(f)->pMethods->xClose(SHIM_REAL(f));
+  f->pMethods = NULL;
+  return rc;
+}
+
+static int shim_read(sqlite3_file* f, void* buf, int amt, sqlite3_int64 off) {
+  return SHIM_REAL(f)->pMethods->xRead(SHIM_REAL(f), buf, amt, off);
+}
+
+static int shim_write(sqlite3_file* f, const void* buf, int amt,
+                      sqlite3_int64 off) {
+  return SHIM_REAL(f)->pMethods->xWrite(SHIM_REAL(f), buf, amt, off);
+}
+
+static int shim_truncate(sqlite3_file* f, sqlite3_int64 size) {
+  return SHIM_REAL(f)->pMethods->xTruncate(SHIM_REAL(f), size);
+}
+
+static int shim_sync(sqlite3_file* f, int flags) {
+  return SHIM_REAL(f)->pMethods->xSync(SHIM_REAL(f), flags);
+}
+
+static int shim_file_size(sqlite3_file* f, sqlite3_int64* size) {
+  return SHIM_REAL(f)->pMethods->xFileSize(SHIM_REAL(f), size);
+}
+
+static int shim_lock(sqlite3_file* f, int lock) {
+  return SHIM_REAL(f)->pMethods->xLock(SHIM_REAL(f), lock);
+}
+
+static int shim_unlock(sqlite3_file* f, int lock) {
+  return SHIM_REAL(f)->pMethods->xUnlock(SHIM_REAL(f), lock);
+}
+
+static int shim_check_reserved_lock(sqlite3_file* f, int* out) {
+  return SHIM_REAL(f)->pMethods->xCheckReservedLock(SHIM_REAL(f), out);
+}
+
+static int shim_file_control(sqlite3_file* f, int op, void* arg) {
+  return SHIM_REAL(f)->pMethods->xFileControl(SHIM_REAL(f), op, arg);
+}
+
+static int shim_sector_size(sqlite3_file* f) {
+  return SHIM_REAL(f)->pMethods->xSectorSize(SHIM_REAL(f));
+}
+
+static int shim_device_characteristics(sqlite3_file* f) {
+  return SHIM_REAL(f)->pMethods->xDeviceCharacteristics(SHIM_REAL(f));
+}
+
+static int shim_shm_map(sqlite3_file* f, int region, int size, int extend,
+                        void volatile** pp) {
+  return SHIM_REAL(f)->pMethods->xShmMap(SHIM_REAL(f), region, size, extend,
+                                         pp);
+}
+
+static int shim_shm_lock(sqlite3_file* f, int offset, int n, int flags) {
+  return SHIM_REAL(f)->pMethods->xShmLock(SHIM_REAL(f), offset, n, flags);
+}
+
+static void shim_shm_barrier(sqlite3_file* f) {
+  SHIM_REAL(f)->pMethods->xShmBarrier(SHIM_REAL(f));
+}
+
+static int shim_shm_unmap(sqlite3_file* f, int delete_flag) {
+  return SHIM_REAL(f)->pMethods->xShmUnmap(SHIM_REAL(f), delete_flag);
+}
+
+static int shim_fetch(sqlite3_file* f, sqlite3_int64 off, int amt,
+                      void** pp) {
+  return SHIM_REAL(f)->pMethods->xFetch(SHIM_REAL(f), off, amt, pp);
+}
+
+static int shim_unfetch(sqlite3_file* f, sqlite3_int64 off, void* p) {
+  return SHIM_REAL(f)->pMethods->xUnfetch(SHIM_REAL(f), off, p);
+}
+
+static int shim_open(sqlite3_vfs* vfs, const char* name, sqlite3_file* f,
+                     int flags, int* out_flags) {
+  VfsShim* shim = SHIM(vfs);
+  ShimFile* file = (ShimFile*)f;
+  memset(file, 0, shim->file_size_);
+  file->real_ = (sqlite3_file*)((char*)f + shim->file_size_);
+  int rc = shim->real_->xOpen(shim->real_, name, file->real_, flags,
+                              out_flags);
+  if (file->real_->pMethods == NULL) {
+    f->pMethods = NULL;
+    return rc;
+  }
+  if (shim->open_ != NULL) rc = shim->open_(f, name, flags, rc);
+  if (file->real_->pMethods->iVersion >= 3) {
+    f->pMethods = &shim->methods_;
+  } else {
+    f->pMethods = &shim->methods_v1_;
+  }
+  return rc;
+}
+
+static int shim_delete(sqlite3_vfs* vfs, const char* name, int sync_dir) {
+  return SHIM(vfs)->real_->xDelete(SHIM(vfs)->real_, name, sync_dir);
+}
+
+static int shim_access(sqlite3_vfs* vfs, const char* name, int flags,
+                       int* out) {
+  return SHIM(vfs)->real_->xAccess(SHIM(vfs)->real_, name, flags, out);
+}
+
+static int shim_full_pathname(sqlite3_vfs* vfs, const char* name, int n,
+                              char* out) {
+  return SHIM(vfs)->real_->xFullPathname(SHIM(vfs)->real_, name, n, out);
+}
+
+static void* shim_dl_open(sqlite3_vfs* vfs, const char* path) {
+  return SHIM(vfs)->real_->xDlOpen(SHIM(vfs)->real_, path);
+}
+
+static void shim_dl_error(sqlite3_vfs* vfs, int n, char* msg) {
+  SHIM(vfs)->real_->xDlError(SHIM(vfs)->real_, n, msg);
+}
+
+static void (*shim_dl_sym(sqlite3_vfs* vfs, void* handle,
+                          const char* sym))(void) {
+  return SHIM(vfs)->real_->xDlSym(SHIM(vfs)->real_, handle, sym);
+}
+
+static void shim_dl_close(sqlite3_vfs* vfs, void* handle) {
+  SHIM(vfs)->real_->xDlClose(SHIM(vfs)->real_, handle);
+}
+
+static int shim_randomness(sqlite3_vfs* vfs, int n, char* out) {
+  return SHIM(vfs)->real_->xRandomness(SHIM(vfs)->real_, n, out);
+}
+
+static int shim_sleep(sqlite3_vfs* vfs, int micros) {
+  return SHIM(vfs)->real_->xSleep(SHIM(vfs)->real_, micros);
+}
+
+static int shim_current_time(sqlite3_vfs* vfs, double* out) {
+  return SHIM(vfs)->real_->xCurrentTime(SHIM(vfs)->real_, out);
+}
+
+static int shim_get_last_error(sqlite3_vfs* vfs, int n, char* out) {
+  return SHIM(vfs)->real_->xGetLastError(SHIM(vfs)->real_, n, out);
+}
+
+static int shim_current_time_int64(sqlite3_vfs* vfs, sqlite3_int64* out) {
+  return SHIM(vfs)->real_->xCurrentTimeInt64(SHIM(vfs)->real_, out);
+}
+
+/*
+ * Set up shim to wrap the current default VFS, with files of file_size
+ * bytes, forwarding everything.  The caller then overrides entries of
+ * shim->methods_, sets shim->open_ if files need setting up, and calls
+ * vfs_shim_register().  A VFS that keeps files of its own overrides
+ * xOpen and the other file entries of shim->vfs_ instead.
+ */
+void vfs_shim_init(VfsShim* shim, const char* name, size_t file_size) {
+  memset(shim, 0, sizeof(*shim));
+  shim->real_ = sqlite3_vfs_find(NULL);
+  if (shim->real_ == NULL) {
+    fprintf(stderr, "no default VFS to wrap\n");
+    exit(1);
+  }
+  shim->file_size_ = file_size;
+
+  sqlite3_vfs* vfs = &shim->vfs_;
+  vfs->iVersion = 2;
+  vfs->szOsFile = file_size + shim->real_->szOsFile;
+  vfs->mxPathname = shim->real_->mxPathname;
+  vfs->zName = name;
+  vfs->pAppData = shim;
+  vfs->xOpen = shim_open;
+  vfs->xDelete = shim_delete;
+  vfs->xAccess = shim_access;
+  vfs->xFullPathname = shim_full_pathname;
+  vfs->xDlOpen = shim_dl_open;
+  vfs->xDlError = shim_dl_error;
+  vfs->xDlSym = shim_dl_sym;
+  vfs->xDlClose = shim_dl_close;
+  vfs->xRandomness = shim_randomness;
+  vfs->xSleep = shim_sleep;
+  vfs->xCurrentTime = shim_current_time;
+  vfs->xGetLastError = shim_get_last_error;
+  vfs->xCurrentTimeInt64 = shim_current_time_int64;
+
+  sqlite3_io_methods* m = &shim->methods_;
+  m->iVersion = 3;
+  m->xClose = shim_close;
+  m->xRead = shim_read;
+  m->xWrite = shim_write;
+  m->xTruncate = shim_truncate;
+  m->xSync = shim_sync;
+  m->xFileSize = shim_file_size;
+  m->xLock = shim_lock;
+  m->xUnlock = shim_unlock;
+  m->xCheckReservedLock = shim_check_reserved_lock;
+  m->xFileControl = shim_file_control;
+  m->xSectorSize = shim_sector_size;
+  m->xDeviceCharacteristics = shim_device_characteristics;
+  m->xShmMap = shim_shm_map;
+  m->xShmLock = shim_shm_lock;
+  m->xShmBarrier = shim_shm_barrier;
+  m->xShmUnmap = shim_shm_unmap;
+  m->xFetch = shim_fetch;
+  m->xUnfetch = shim_unfetch;
+}
+
+/* Make shim the default VFS */
+void vfs_shim_register(VfsShim* shim) {
+  /* Real files with version 1 methods have no WAL index or mapping */
+  shim->methods_v1_ = shim->methods_;
+  shim->methods_v1_.iVersion = 1;
+  shim->methods_v1_.xShmMap = NULL;
+  shim->methods_v1_.xShmLock = NULL;
+  shim->methods_v1_.xShmBarrier = NULL;
+  shim->methods_v1_.xShmUnmap = NULL;
+  shim->methods_v1_.xFetch = NULL;
+  shim->methods_v1_.xUnfetch = NULL;
+  if (sqlite3_vfs_register(&shim->vfs_, 1) != SQLITE_OK) {
+    fprintf(stderr, "failed to register the %s VFS\n", shim->vfs_.zName);
+    exit(1);
+  }
+}
@@ -0,0 +1,214 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * VFS shim for --vfs_stats.  It counts calls, bytes and latency per I/O
+ * method of the VFS that was the default before.
+ */
+
+enum VfsMethod {
+  VFS_READ,
+  VFS_WRITE,
+  VFS_TRUNCATE,
+  VFS_SYNC,
+  VFS_FILE_SIZE,
+  VFS_LOCK,
+  VFS_UNLOCK,
+  VFS_CHECK_RESERVED_LOCK,
+  VFS_SHM_MAP,
+  VFS_SHM_LOCK,
+  VFS_SHM_BARRIER,
+  VFS_SHM_UNMAP,
+  kNumVfsMethods
+};
+
+static const char* vfs_method_names[kNumVfsMethods] = {
+  "xRead", "xWrite", "xTruncate", "xSync", "xFileSize", "xLock", "xUnlock",
+  "xCheckReservedLock", "xShmMap", "xShmLock", "xShmBarrier", "xShmUnmap"
+};
+
+typedef struct VfsMethodStats {
+  int64_t calls_;
+  int64_t bytes_;
+  Histogram hist_;
+} VfsMethodStats;
+
+static VfsMethodStats vfs_stats_[kNumVfsMethods];
+static pthread_mutex_t vfs_stats_mu_ = PTHREAD_MUTEX_INITIALIZER;
+
+static VfsShim stats_shim_;
+
+static void vfs_record(int method, uint64_t start, int64_t bytes) {
+  uint64_t nanos = now_nanos() - start;
+  VfsMethodStats* s = &vfs_stats_[method];
+  pthread_mutex_lock(&vfs_stats_mu_);
+  s->calls_++;
+  s->bytes_ += bytes;
+  histogram_add(&s->hist_, (double)nanos);
+  pthread_mutex_unlock(&vfs_stats_mu_);
+}
+
+static int stats_read(sqlite3_file* f, void* buf, int amt, sqlite3_int64 off) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xRead(SHIM_REAL(f), buf, amt, off);
+  vfs_record(VFS_READ, start, amt);
+  return rc;
+}
+
+static int stats_write(sqlite3_file* f, const void* buf, int amt,
+                       sqlite3_int64 off) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xWrite(SHIM_REAL(f), buf, amt, off);
+  vfs_record(VFS_WRITE, start, amt);
+  return rc;
+}
+
+static int stats_truncate(sqlite3_file* f, sqlite3_int64 size) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xTruncate(SHIM_REAL(f), size);
+  vfs_record(VFS_TRUNCATE, start, 0);
+  return rc;
+}
+
+static int stats_sync(sqlite3_file* f, int flags) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xSync(SHIM_REAL(f), flags);
+  vfs_record(VFS_SYNC, start, 0);
+  return rc;
+}
+
+static int stats_file_size(sqlite3_file* f, sqlite3_int64* size) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xFileSize(SHIM_REAL(f), size);
+  vfs_record(VFS_FILE_SIZE, start, 0);
+  return rc;
+}
+
+static int stats_lock(sqlite3_file* f, int lock) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xLock(SHIM_REAL(f), lock);
+  vfs_record(VFS_LOCK, start, 0);
+  return rc;
+}
+
+static int stats_unlock(sqlite3_file* f, int lock) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xUnlock(SHIM_REAL(f), lock);
+  vfs_record(VFS_UNLOCK, start, 0);
+  return rc;
+}
+
+static int stats_check_reserved_lock(sqlite3_file* f, int* out) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xCheckReservedLock(SHIM_REAL(f), out);
+  vfs_record(VFS_CHECK_RESERVED_LOCK, start, 0);
+  return rc;
+}
+
+static int stats_shm_map(sqlite3_file* f, int region, int size, int extend,
+                         void volatile** pp) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xShmMap(SHIM_REAL(f), region, size,
+                                           extend, pp);
+  vfs_record(VFS_SHM_MAP, start, 0);
+  return rc;
+}
+
+static int stats_shm_lock(sqlite3_file* f, int offset, int n, int flags) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xShmLock(SHIM_REAL(f), offset, n, flags);
+  vfs_record(VFS_SHM_LOCK, start, 0);
+  return rc;
+}
+
+static void stats_shm_barrier(sqlite3_file* f) {
+  uint64_t start = now_nanos();
+  SHIM_REAL(f)->pMethods->xShmBarrier(SHIM_REAL(f));
+  vfs_record(VFS_SHM_BARRIER, start, 0);
+}
+
+static int stats_shm_unmap(sqlite3_file* f, int delete_flag) {
+  uint64_t start = now_nanos();
+  int rc = SHIM_REAL(f)->pMethods->xShmUnmap(SHIM_REAL(f), delete_flag);
+  vfs_record(VFS_SHM_UNMAP, start, 0);
+  return rc;
+}
+
+void vfs_stats_init() {
+  vfs_shim_init(&stats_shim_, "stats", sizeof(ShimFile));
+  sqlite3_io_methods* m = &stats_shim_.methods_;
+  m->xRead = stats_read;
+  m->xWrite = stats_write;
+  m->xTruncate = stats_truncate;
+  m->xSync = stats_sync;
+  m->xFileSize = stats_file_size;
+  m->xLock = stats_lock;
+  m->xUnlock = stats_unlock;
+  m->xCheckReservedLock = stats_check_reserved_lock;
+  m->xShmMap = stats_shm_map;
+  m->xShmLock = stats_shm_lock;
+  m->xShmBarrier = stats_shm_barrier;
+  m->xShmUnmap = stats_shm_unmap;
+  vfs_shim_register(&stats_shim_);
+  vfs_stats_reset();
+}
+
+void vfs_stats_reset() {
+  pthread_mutex_lock(&vfs_stats_mu_);
+  for (int i = 0; i < kNumVfsMethods; i++) {
+    vfs_stats_[i].calls_ = 0;
+    vfs_stats_[i].bytes_ = 0;
+    histogram_clear(&vfs_stats_[i].hist_);
+  }
+  pthread_mutex_unlock(&vfs_stats_mu_);
+}
+
+/*
+ * Print the calls since the last reset, and the bytes written through the
+ * VFS per byte of key-value data the benchmark wrote.
+ */
+void vfs_stats_print(FILE* f, int64_t data_bytes) {
+  pthread_mutex_lock(&vfs_stats_mu_);
+  for (int i = 0; i < kNumVfsMethods; i++) {
+    VfsMethodStats* s = &vfs_stats_[i];
+    if (s->calls_ == 0) continue;
+    fprintf(f, "  %-15s : %11" PRId64 " calls", vfs_method_names[i],
+            s->calls_);
+    if (s->bytes_ > 0) {
+      fprintf(f, "; %12" PRId64 " bytes", s->bytes_);
+    }
+    fprintf(f, "; %9.3f micros/call; p50 %.3f p99 %.3f\n",
+            s->hist_.sum_ / s->hist_.num_ * 1e-3,
+            histogram_percentile(&s->hist_, 50.0) * 1e-3,
+            histogram_percentile(&s->hist_, 99.0) * 1e-3);
+  }
+  if (data_bytes > 0 && vfs_stats_[VFS_WRITE].bytes_ > 0) {
+    fprintf(f, "  %-15s : %11.2f\n", "write amp",
+            (double)vfs_stats_[VFS_WRITE].bytes_ / data_bytes);
+  }
+  pthread_mutex_unlock(&vfs_stats_mu_);
+}
+
+/* The same figures as an object of the --report document */
+void vfs_stats_report(int64_t data_bytes) {
+  pthread_mutex_lock(&vfs_stats_mu_);
+  report_begin_object("vfs");
+  for (int i = 0; i < kNumVfsMethods; i++) {
+    VfsMethodStats* s = &vfs_stats_[i];
+    if (s->calls_ == 0) continue;
+    report_begin_object(vfs_method_names[i]);
+    report_int("calls", s->calls_);
+    report_int("bytes", s->bytes_);
+    report_histogram("histogram", &s->hist_);
+    report_end_object();
+  }
+  if (data_bytes > 0) {
+    report_double("write_amplification",
+                  (double)vfs_stats_[VFS_WRITE].bytes_ / data_bytes);
+  }
+  report_end_object();
+  pthread_mutex_unlock(&vfs_stats_mu_);
+}
@@ -0,0 +1,332 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <math.h>
+
+/*
+ * Workload files for --workload.  A file is a list of phases, run in
+ * order, each a [name] line followed by "key = value" settings:
+ *
+ *   # Load 100k keys in big transactions, then run a mixed phase
+ *   [load]
+ *   fresh = 1
+ *   mix = put:1
+ *   keys = sequential
+ *   batch = 1000
+ *   ops = 100000
+ *
+ *   [steady]
+ *   mix = get:80, put:15, delete:3, scan:1, rmw:1
+ *   keys = zipfian
+ *   zipf_theta = 0.99
+ *   value_size = uniform:64,512
+ *   scan_length = uniform:1,100
+ *   threads = 4
+ *   duration = 30
+ *
+ * Settings:
+ *   mix          weighted ops: get, put, insert (a key past the key
+ *                space), delete, scan, rmw (read-modify-write)
+ *   keys         a --key_dist name, or "sequential"
+ *   key_space    keys the phase draws from; default --num plus inserts
+ *   zipf_theta, hotspot_ops_fraction, hotspot_keys_fraction
+ *                as the flags of the same names, which are the defaults
+ *   value_size   fixed:N, uniform:MIN,MAX or normal:MEAN,STDDEV
+ *   scan_length  fixed:N or uniform:MIN,MAX
+ *   ops          ops per thread; --num if neither ops nor duration is set
+ *   duration     seconds; the phase ends at whichever limit comes first
+ *   threads      threads, each with its own connection
+ *   batch        ops per transaction
+ *   sync         1 for PRAGMA synchronous = FULL
+ *   fresh        1 to start the phase on a new, empty database
+ */
+
+#define kMaxValueSize 1000000
+
+static const char* op_names[kNumOpTypes] = {
+  "get", "put", NULL, "insert", "scan", "rmw", "delete"
+};
+
+static void parse_error(const char* path, int line, const char* msg,
+                        const char* text) {
+  fprintf(stderr, "%s:%d: %s '%s'\n", path, line, msg, text);
+  exit(1);
+}
+
+static bool parse_size_dist(SizeDist* dist, const char* text, int max) {
+  double a, b;
+  char junk;
+  if (sscanf(text, "fixed:%lf%c", &a, &junk) == 1) {
+    dist->kind_ = SIZE_FIXED;
+    b = a;
+  } else if (sscanf(text, "uniform:%lf,%lf%c", &a, &b, &junk) == 2) {
+    dist->kind_ = SIZE_UNIFORM;
+  } else if (sscanf(text, "normal:%lf,%lf%c", &a, &b, &junk) == 2) {
+    dist->kind_ = SIZE_NORMAL;
+    dist->a_ = a;
+    dist->b_ = b;
+    return a >= 1 && a <= max && b >= 0;
+  } else {
+    return false;
+  }
+  dist->a_ = a;
+  dist->b_ = b;
+  return a >= 1 && b >= a && b <= max && a == (int)a && b == (int)b;
+}
+
+/* Parse "name:weight, name:weight ..." into cumulative probabilities */
+static bool parse_mix(WorkloadPhase* phase, const char* text) {
+  double weights[kNumOpTypes] = { 0 };
+  double total = 0;
+  char* copy = strdup(text);
+  char* save = NULL;
+  bool ok = true;
+  for (char* tok = strtok_r(copy, ", \t", &save); tok != NULL;
+       tok = strtok_r(NULL, ", \t", &save)) {
+    char* colon = strchr(tok, ':');
+    double w;
+    char junk;
+    if (colon == NULL || sscanf(colon + 1, "%lf%c", &w, &junk) != 1 ||
+        w < 0) {
+      ok = false;
+      break;
+    }
+    *colon = '\0';
+    int op = -1;
+    for (int i = 0; i < kNumOpTypes; i++) {
+      if (op_names[i] != NULL && !strcmp(tok, op_names[i])) op = i;
+    }
+    if (op < 0) {
+      ok = false;
+      break;
+    }
+    weights[op] += w;
+    total += w;
+  }
+  free(copy);
+  if (!ok || total <= 0) return false;
+  double sum = 0;
+  int last = 0;
+  for (int i = 0; i < kNumOpTypes; i++) {
+    sum += weights[i];
+    phase->mix_[i] = sum / total;
+    if (weights[i] > 0) last = i;
+  }
+  /* So that rounding can never pick an op with no weight */
+  for (int i = last; i < kNumOpTypes; i++) phase->mix_[i] = 1;
+  return true;
+}
+
+static bool parse_int(const char* text, int64_t min, int64_t* out) {
+  char junk;
+  return sscanf(text, "%" SCNd64 "%c", out, &junk) == 1 && *out >= min;
+}
+
+static bool parse_fraction(const char* text, double* out) {
+  char junk;
+  return sscanf(text, "%lf%c", out, &junk) == 1 && *out >= 0 && *out <= 1;
+}
+
+static void phase_init(WorkloadPhase* phase, const char* name) {
+  memset(phase, 0, sizeof(*phase));
+  snprintf(phase->name_, sizeof(phase->name_), "%s", name);
+  /* All gets unless the phase sets a mix */
+  for (int i = 0; i < kNumOpTypes; i++) phase->mix_[i] = 1;
+  phase->key_dist_ = key_dist_from_string(FLAGS_key_dist);
+  phase->zipf_theta_ = FLAGS_zipf_theta;
+  phase->hot_ops_fraction_ = FLAGS_hotspot_ops_fraction;
+  phase->hot_keys_fraction_ = FLAGS_hotspot_keys_fraction;
+  phase->value_size_.kind_ = SIZE_FIXED;
+  phase->value_size_.a_ = phase->value_size_.b_ = FLAGS_value_size;
+  phase->scan_length_.kind_ = SIZE_FIXED;
+  phase->scan_length_.a_ = phase->scan_length_.b_ = FLAGS_scan_length;
+  phase->threads_ = 1;
+  phase->batch_ = 1;
+}
+
+static void phase_set(WorkloadPhase* phase, const char* key,
+                      const char* value, const char* path, int line) {
+  int64_t n;
+  double d;
+  char junk;
+  if (!strcmp(key, "mix")) {
+    if (!parse_mix(phase, value)) parse_error(path, line, "bad mix", value);
+  } else if (!strcmp(key, "keys")) {
+    phase->sequential_ = !strcmp(value, "sequential");
+    if (!phase->sequential_) {
+      phase->key_dist_ = key_dist_from_string(value);
+      if (phase->key_dist_ < 0) {
+        parse_error(path, line, "unknown key distribution", value);
+      }
+    }
+  } else if (!strcmp(key, "key_space")) {
+    if (!parse_int(value, 1, &n) || n > INT32_MAX) {
+      parse_error(path, line, "bad key_space", value);
+    }
+    phase->key_space_ = n;
+  } else if (!strcmp(key, "zipf_theta")) {
+    if (sscanf(value, "%lf%c", &d, &junk) != 1 || d <= 0 || d >= 1) {
+      parse_error(path, line, "zipf_theta must be in (0, 1)", value);
+    }
+    phase->zipf_theta_ = d;
+  } else if (!strcmp(key, "hotspot_ops_fraction")) {
+    if (!parse_fraction(value, &phase->hot_ops_fraction_)) {
+      parse_error(path, line, "bad fraction", value);
+    }
+  } else if (!strcmp(key, "hotspot_keys_fraction")) {
+    if (!parse_fraction(value, &phase->hot_keys_fraction_)) {
+      parse_error(path, line, "bad fraction", value);
+    }
+  } else if (!strcmp(key, "value_size")) {
+    if (!parse_size_dist(&phase->value_size_, value, kMaxValueSize)) {
+      parse_error(path, line, "bad value_size", value);
+    }
+  } else if (!strcmp(key, "scan_length")) {
+    if (!parse_size_dist(&phase->scan_length_, value, INT32_MAX) ||
+        phase->scan_length_.kind_ == SIZE_NORMAL) {
+      parse_error(path, line, "bad scan_length", value);
+    }
+  } else if (!strcmp(key, "ops")) {
+    if (!parse_int(value, 1, &n)) parse_error(path, line, "bad ops", value);
+    phase->ops_ = n;
+  } else if (!strcmp(key, "duration")) {
+    if (sscanf(value, "%lf%c", &d, &junk) != 1 || d <= 0) {
+      parse_error(path, line, "bad duration", value);
+    }
+    phase->seconds_ = d;
+  } else if (!strcmp(key, "threads")) {
+    if (!parse_int(value, 1, &n) || n > 1024) {
+      parse_error(path, line, "bad threads", value);
+    }
+    phase->threads_ = n;
+  } else if (!strcmp(key, "batch")) {
+    if (!parse_int(value, 1, &n) || n > INT32_MAX) {
+      parse_error(path, line, "bad batch", value);
+    }
+    phase->batch_ = n;
+  } else if (!strcmp(key, "sync") || !strcmp(key, "fresh")) {
+    if (!parse_int(value, 0, &n) || n > 1) {
+      parse_error(path, line, "expected 0 or 1", value);
+    }
+    if (!strcmp(key, "sync")) {
+      phase->sync_ = n;
+    } else {
+      phase->fresh_ = n;
+    }
+  } else {
+    parse_error(path, line, "unknown setting", key);
+  }
+}
+
+/* Read a workload file; exits with a message on any error */
+void workload_load(Workload* w, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    exit(1);
+  }
+  w->phases_ = NULL;
+  w->num_phases_ = 0;
+  char buf[1024];
+  int line = 0;
+  while (fgets(buf, sizeof(buf), f) != NULL) {
+    line++;
+    char* hash = strchr(buf, '#');
+    if (hash != NULL) *hash = '\0';
+    char* text = trim_space(buf);
+    size_t len = strlen(text);
+    if (len == 0) {
+      free(text);
+      continue;
+    }
+    if (text[0] == '[') {
+      if (text[len - 1] != ']' || len == 2) {
+        parse_error(path, line, "bad phase name", text);
+      }
+      text[len - 1] = '\0';
+      w->phases_ = realloc(w->phases_,
+                           sizeof(WorkloadPhase) * (w->num_phases_ + 1));
+      phase_init(&w->phases_[w->num_phases_++], text + 1);
+    } else {
+      char* eq = strchr(text, '=');
+      if (eq == NULL) parse_error(path, line, "expected key = value", text);
+      if (w->num_phases_ == 0) {
+        parse_error(path, line, "setting before the first [phase]", text);
+      }
+      *eq = '\0';
+      char* key = trim_space(text);
+      char* value = trim_space(eq + 1);
+      phase_set(&w->phases_[w->num_phases_ - 1], key, value, path, line);
+      free(key);
+      free(value);
+    }
+    free(text);
+  }
+  fclose(f);
+  if (w->num_phases_ == 0) {
+    fprintf(stderr, "%s has no phases\n", path);
+    exit(1);
+  }
+  for (int i = 0; i < w->num_phases_; i++) {
+    WorkloadPhase* phase = &w->phases_[i];
+    if (phase->ops_ == 0 && phase->seconds_ == 0) phase->ops_ = FLAGS_num;
+  }
+}
+
+void workload_free(Workload* w) {
+  free(w->phases_);
+  w->phases_ = NULL;
+  w->num_phases_ = 0;
+}
+
+/* Draw an op type from the phase's mix */
+int workload_next_op(const WorkloadPhase* phase, Random* rand) {
+  double p = rand_double(rand);
+  int op = 0;
+  while (op < kNumOpTypes - 1 && p >= phase->mix_[op]) op++;
+  return op;
+}
+
+/*
+ * Whether the phase's mix has weight on any op that writes.  mix_ is
+ * cumulative, so an op has weight when its entry is above the one before
+ * it; get and scan are the only ops that just read, and everything from
+ * put to insert and from rmw to delete writes.
+ */
+bool workload_writes(const WorkloadPhase* phase) {
+  return phase->mix_[OP_INSERT] > phase->mix_[OP_READ] ||
+         phase->mix_[OP_DELETE] > phase->mix_[OP_SCAN];
+}
+
+/* Draw a size from dist, clamped to [1, max] */
+static int next_size(const SizeDist* dist, Random* rand, int max) {
+  double size;
+  switch (dist->kind_) {
+    case SIZE_UNIFORM:
+      size = dist->a_ + rand_uniform(rand, (int)(dist->b_ - dist->a_) + 1);
+      break;
+    case SIZE_NORMAL: {
+      /* Box-Muller */
+      double u = 1.0 - rand_double(rand);
+      double v = rand_double(rand);
+      size = dist->a_ + dist->b_ * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+      break;
+    }
+    default:
+      size = dist->a_;
+  }
+  if (size < 1) return 1;
+  if (size > max) return max;
+  return (int)size;
+}
+
+int workload_value_size(const WorkloadPhase* phase, Random* rand) {
+  return next_size(&phase->value_size_, rand, kMaxValueSize);
+}
+
+int workload_scan_length(const WorkloadPhase* phase, Random* rand) {
+  return next_size(&phase->scan_length_, rand, INT32_MAX);
+}